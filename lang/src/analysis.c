@@ -0,0 +1,300 @@
+#include "analysis.h"
+#include "core.h"
+
+IRAnalysis* new_ir_analysis(Arena* arena) {
+    CompileContext* ctx = get_compile_context();
+    assert(!ctx->analysis_owner && "the compile context already backs another IR's analyses");
+
+    IRAnalysis* a = arena_push_type(arena, IRAnalysis);
+    ctx->analysis_owner = a;
+    a->cfg_arena = &ctx->cfg_arena;
+    a->instrs_arena = &ctx->instrs_arena;
+    return a;
+}
+
+internal void post_order(IRAnalysis* a, bool* visited, int* count, IRBasicBlock* b) {
+    if (visited[b->id])
+        return;
+    visited[b->id] = true;
+
+    BBList succ = bb_get_succ(b);
+    for (int i = 0; i < succ.count; ++i)
+        post_order(a, visited, count, succ.data[i]);
+
+    a->rpo[(*count)++] = b;
+}
+
+internal void compute_cfg(IRAnalysis* a, IR* ir) {
+    Scratch scratch = get_scratch(&a->cfg_arena, 1);
+
+    int nblock = ir_block_count(ir);
+    a->block_count = nblock;
+
+    a->pred_offset = arena_push_array(a->cfg_arena, int, nblock + 1);
+
+    // A branch with both targets the same is a single edge.
+    FOREACH_IR_BB(b, ir->first_block) {
+        BBList succ = bb_get_succ(b);
+        for (int i = 0; i < succ.count; ++i) {
+            if (i == 0 || succ.data[i] != succ.data[0])
+                a->pred_offset[succ.data[i]->id + 1]++;
+        }
+    }
+
+    for (int i = 0; i < nblock; ++i)
+        a->pred_offset[i + 1] += a->pred_offset[i];
+
+    a->preds = arena_push_array(a->cfg_arena, IRBasicBlock*, a->pred_offset[nblock]);
+
+    int* fill = arena_push_array(scratch.arena, int, nblock);
+    memcpy(fill, a->pred_offset, nblock * sizeof(int));
+
+    FOREACH_IR_BB(b, ir->first_block) {
+        BBList succ = bb_get_succ(b);
+        for (int i = 0; i < succ.count; ++i) {
+            if (i == 0 || succ.data[i] != succ.data[0])
+                a->preds[fill[succ.data[i]->id]++] = b;
+        }
+    }
+
+    a->rpo = arena_push_array(a->cfg_arena, IRBasicBlock*, nblock);
+    a->rpo_index = arena_push_array(a->cfg_arena, int, nblock);
+
+    bool* visited = arena_push_array(scratch.arena, bool, nblock);
+    a->rpo_count = 0;
+    post_order(a, visited, &a->rpo_count, ir->first_block);
+
+    for (int i = 0; i < a->rpo_count / 2; ++i) {
+        IRBasicBlock* temp = a->rpo[i];
+        a->rpo[i] = a->rpo[a->rpo_count - 1 - i];
+        a->rpo[a->rpo_count - 1 - i] = temp;
+    }
+
+    for (int i = 0; i < nblock; ++i)
+        a->rpo_index[i] = -1;
+    for (int i = 0; i < a->rpo_count; ++i)
+        a->rpo_index[a->rpo[i]->id] = i;
+
+    release_scratch(&scratch);
+}
+
+internal IRBasicBlock* intersect(IRAnalysis* a, IRBasicBlock* b1, IRBasicBlock* b2) {
+    while (b1 != b2) {
+        while (a->rpo_index[b1->id] > a->rpo_index[b2->id])
+            b1 = a->idom[b1->id];
+        while (a->rpo_index[b2->id] > a->rpo_index[b1->id])
+            b2 = a->idom[b2->id];
+    }
+    return b1;
+}
+
+// Cooper, Harvey and Kennedy, "A Simple, Fast Dominance Algorithm".
+internal void compute_dom(IRAnalysis* a, IR* ir) {
+    int nblock = a->block_count;
+
+    a->idom = arena_push_array(a->cfg_arena, IRBasicBlock*, nblock);
+    a->idom[ir->first_block->id] = ir->first_block;
+
+    for (bool changed = true; changed;)
+    {
+        changed = false;
+
+        for (int i = 1; i < a->rpo_count; ++i)
+        {
+            IRBasicBlock* b = a->rpo[i];
+
+            IRBasicBlock* new_idom = 0;
+            FOREACH_PRED(p, a, b) {
+                if (!a->idom[(*p)->id])
+                    continue;
+                new_idom = new_idom ? intersect(a, *p, new_idom) : *p;
+            }
+
+            assert(new_idom);
+            if (a->idom[b->id] != new_idom) {
+                a->idom[b->id] = new_idom;
+                changed = true;
+            }
+        }
+    }
+
+    a->idom[ir->first_block->id] = 0;
+
+    a->dom_child_offset = arena_push_array(a->cfg_arena, int, nblock + 1);
+    for (int i = 0; i < a->rpo_count; ++i) {
+        IRBasicBlock* dom = a->idom[a->rpo[i]->id];
+        if (dom)
+            a->dom_child_offset[dom->id + 1]++;
+    }
+
+    for (int i = 0; i < nblock; ++i)
+        a->dom_child_offset[i + 1] += a->dom_child_offset[i];
+
+    Scratch scratch = get_scratch(&a->cfg_arena, 1);
+
+    a->dom_children = arena_push_array(a->cfg_arena, IRBasicBlock*, a->dom_child_offset[nblock]);
+
+    int* fill = arena_push_array(scratch.arena, int, nblock);
+    memcpy(fill, a->dom_child_offset, nblock * sizeof(int));
+
+    for (int i = 0; i < a->rpo_count; ++i) {
+        IRBasicBlock* b = a->rpo[i];
+        IRBasicBlock* dom = a->idom[b->id];
+        if (dom)
+            a->dom_children[fill[dom->id]++] = b;
+    }
+
+    release_scratch(&scratch);
+}
+
+// Iterate LiveOut(n) = U over successors m of (UEVar(m) | (LiveOut(m) & ~VarKill(m)))
+// to a fixed point. live_out may be seeded with bits that are live on exit for
+// other reasons, such as phi operands.
+void solve_live_out(IR* ir, u32 nbits, Bitset** ue_var, Bitset** var_kill, Bitset** live_out) {
+    u32 num_u32 = num_u32_for_bits(nbits);
+
+    for (;;) {
+        bool changed = false;
+
+        FOREACH_IR_BB(n, ir->first_block) {
+            BBList succ = bb_get_succ(n);
+            for (int s = 0; s < succ.count; ++s)
+            {
+                IRBasicBlock* m = succ.data[s];
+                for (u32 j = 0; j < num_u32; ++j)
+                {
+                    u32* dw = &live_out[n->id]->p[j];
+
+                    u32 ue_var_m   = ue_var  [m->id]->p[j];
+                    u32 live_out_m = live_out[m->id]->p[j];
+                    u32 var_kill_m = var_kill[m->id]->p[j];
+
+                    u32 add = ue_var_m | (live_out_m & ~var_kill_m);
+                    if ((add | *dw) != *dw) {
+                        changed = true;
+                        *dw |= add;
+                    }
+                }
+            }
+        }
+
+        if (!changed)
+            break;
+    }
+}
+
+internal void compute_liveness(IRAnalysis* a, IR* ir) {
+    Scratch scratch = get_scratch(&a->instrs_arena, 1);
+
+    int nblock = a->block_count;
+    u32 nreg = ir->next_reg;
+    a->reg_count = nreg;
+
+    Bitset** ue_var   = arena_push_array(scratch.arena, Bitset*, nblock);
+    Bitset** var_kill = arena_push_array(scratch.arena, Bitset*, nblock);
+
+    a->live_in  = arena_push_array(a->instrs_arena, Bitset*, nblock);
+    a->live_out = arena_push_array(a->instrs_arena, Bitset*, nblock);
+
+    FOREACH_IR_BB(b, ir->first_block)
+    {
+        ue_var[b->id]   = bitset_alloc(scratch.arena, nreg);
+        var_kill[b->id] = bitset_alloc(scratch.arena, nreg);
+
+        a->live_in[b->id]  = bitset_alloc(a->instrs_arena, nreg);
+        a->live_out[b->id] = bitset_alloc(a->instrs_arena, nreg);
+    }
+
+    FlatIR* f = &a->instrs;
+    for (u32 i = 0; i < f->instr_count; ++i)
+    {
+        u32 b = f->block[i];
+
+        for (u32 k = f->operand_offset[i]; k < f->operand_offset[i + 1]; ++k)
+        {
+            if (f->operand_kind[k] != IR_VALUE_REG)
+                continue;
+
+            IRReg reg = (IRReg)f->operand_val[k];
+
+            // Phi operands are used at the end of the incoming block.
+            if (f->operand_block[k] >= 0)
+                bitset_set(a->live_out[f->operand_block[k]], reg);
+            else if (!bitset_get(var_kill[b], reg))
+                bitset_set(ue_var[b], reg);
+        }
+
+        if (f->dest[i] != IR_EMPTY_REG)
+            bitset_set(var_kill[b], f->dest[i]);
+    }
+
+    solve_live_out(ir, nreg, ue_var, var_kill, a->live_out);
+
+    u32 num_u32 = num_u32_for_bits(nreg);
+    FOREACH_IR_BB(b, ir->first_block) {
+        for (u32 j = 0; j < num_u32; ++j)
+            a->live_in[b->id]->p[j] = ue_var[b->id]->p[j] | (a->live_out[b->id]->p[j] & ~var_kill[b->id]->p[j]);
+    }
+
+    release_scratch(&scratch);
+}
+
+IRAnalysis* get_ir_analysis(IR* ir, u32 required) {
+    IRAnalysis* a = ir->analysis;
+    assert(a);
+    assert(get_compile_context()->analysis_owner == a && "IR analysed under a compile context it wasn't generated in");
+
+    if (required & (ANALYSIS_DOM | ANALYSIS_LIVENESS))
+        required |= ANALYSIS_CFG;
+    if (required & ANALYSIS_LIVENESS)
+        required |= ANALYSIS_INSTRS;
+
+    // A pass that changed the CFG without invalidating usually shows up here.
+    assert(!(a->valid & ANALYSIS_CFG) || a->block_count == ir_block_count(ir));
+
+    // Dropping an analysis drops everything after it in the same arena, so
+    // rewinding can't free anything still valid.
+    if ((required & ANALYSIS_CFG) && !(a->valid & ANALYSIS_CFG)) {
+        a->cfg_arena->used = 0;
+        compute_cfg(a, ir);
+        a->dom_mark = a->cfg_arena->used;
+        a->valid |= ANALYSIS_CFG;
+    }
+
+    if ((required & ANALYSIS_DOM) && !(a->valid & ANALYSIS_DOM)) {
+        a->cfg_arena->used = a->dom_mark;
+        compute_dom(a, ir);
+        a->valid |= ANALYSIS_DOM;
+    }
+
+    if ((required & ANALYSIS_INSTRS) && !(a->valid & ANALYSIS_INSTRS)) {
+        a->instrs_arena->used = 0;
+        a->instrs = flatten_ir(a->instrs_arena, ir);
+        a->liveness_mark = a->instrs_arena->used;
+        a->valid |= ANALYSIS_INSTRS;
+    }
+
+    if ((required & ANALYSIS_LIVENESS) && !(a->valid & ANALYSIS_LIVENESS)) {
+        a->instrs_arena->used = a->liveness_mark;
+        compute_liveness(a, ir);
+        a->valid |= ANALYSIS_LIVENESS;
+    }
+
+    return a;
+}
+
+void invalidate_ir_analysis(IR* ir, u32 kinds) {
+    if (kinds & ANALYSIS_CFG)
+        kinds |= ANALYSIS_ALL;
+    if (kinds & ANALYSIS_INSTRS)
+        kinds |= ANALYSIS_LIVENESS;
+    ir->analysis->valid &= ~kinds;
+}
+
+bool dominates(IRAnalysis* a, IRBasicBlock* dom, IRBasicBlock* b) {
+    for (; b; b = a->idom[b->id]) {
+        if (b == dom)
+            return true;
+    }
+    return false;
+}
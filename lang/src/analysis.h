@@ -0,0 +1,72 @@
+#pragma once
+
+#include "flat_ir.h"
+
+enum {
+    ANALYSIS_CFG      = BIT(0),
+    ANALYSIS_DOM      = BIT(1),
+    ANALYSIS_LIVENESS = BIT(2),
+    ANALYSIS_INSTRS   = BIT(3),
+
+    ANALYSIS_ALL = ANALYSIS_CFG | ANALYSIS_DOM | ANALYSIS_LIVENESS | ANALYSIS_INSTRS,
+};
+
+// Analyses cached on an IR between passes. Everything is indexed by block id.
+//
+// Results live in the cfg and instrs arenas of the compile context the cache
+// was created under, not in the IR's arena. Recomputing an analysis rewinds
+// its arena to where that analysis started, so invalidating and recomputing
+// reuses the same memory.
+//
+// Because of that, a compile context backs the analyses of one IR at a time:
+// generating a second IR under the same context asserts until the context is
+// reset, which also discards the first IR.
+//
+// A pass that changes blocks or edges must invalidate ANALYSIS_CFG, which also
+// drops everything derived from it. A pass that only changes instructions must
+// invalidate ANALYSIS_INSTRS, which also drops ANALYSIS_LIVENESS.
+struct IRAnalysis {
+    Arena* cfg_arena;    // ANALYSIS_CFG, then ANALYSIS_DOM from dom_mark
+    Arena* instrs_arena; // ANALYSIS_INSTRS, then ANALYSIS_LIVENESS from liveness_mark
+    size_t dom_mark;
+    size_t liveness_mark;
+
+    u32 valid;
+    int block_count;
+
+    // ANALYSIS_CFG: predecessors of block b are preds[pred_offset[b]..pred_offset[b+1]].
+    // Blocks unreachable from the entry have an rpo_index of -1.
+    int* pred_offset;
+    IRBasicBlock** preds;
+    int rpo_count;
+    IRBasicBlock** rpo;
+    int* rpo_index;
+
+    // ANALYSIS_DOM: children of block b in the dominator tree are
+    // dom_children[dom_child_offset[b]..dom_child_offset[b+1]].
+    IRBasicBlock** idom;
+    int* dom_child_offset;
+    IRBasicBlock** dom_children;
+
+    // ANALYSIS_INSTRS: a flattened copy of the instructions.
+    FlatIR instrs;
+
+    // ANALYSIS_LIVENESS: registers live on entry to and exit from each block.
+    // Phis define their register at the start of their block and use their
+    // operands at the end of the corresponding predecessor.
+    u32 reg_count;
+    Bitset** live_in;
+    Bitset** live_out;
+};
+
+IRAnalysis* new_ir_analysis(Arena* arena);
+
+IRAnalysis* get_ir_analysis(IR* ir, u32 required);
+void invalidate_ir_analysis(IR* ir, u32 kinds);
+
+bool dominates(IRAnalysis* a, IRBasicBlock* dom, IRBasicBlock* b);
+
+void solve_live_out(IR* ir, u32 nbits, Bitset** ue_var, Bitset** var_kill, Bitset** live_out);
+
+#define FOREACH_PRED(name, a, b) for (IRBasicBlock** name = (a)->preds + (a)->pred_offset[(b)->id]; name < (a)->preds + (a)->pred_offset[(b)->id + 1]; ++name)
+#define FOREACH_DOM_CHILD(name, a, b) for (IRBasicBlock** name = (a)->dom_children + (a)->dom_child_offset[(b)->id]; name < (a)->dom_children + (a)->dom_child_offset[(b)->id + 1]; ++name)
@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <time.h>
+#endif
+
+#include "base.h"
+
+#define ARENA_COMMIT_GRANULARITY (64 * 1024)
+
+Arena arena_create(size_t reserve) {
+#ifdef _WIN32
+    void* ptr = VirtualAlloc(0, reserve, MEM_RESERVE, PAGE_NOACCESS);
+#else
+    void* ptr = mmap(0, reserve, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (ptr == MAP_FAILED)
+        ptr = 0;
+#endif
+
+    if (!ptr) {
+        printf("Failed to reserve %zu bytes for an arena.\n", reserve);
+        exit(1);
+    }
+
+    return (Arena) {
+        .ptr = ptr,
+        .cap = reserve,
+    };
+}
+
+void arena_destroy(Arena* arena) {
+#ifdef _WIN32
+    VirtualFree(arena->ptr, 0, MEM_RELEASE);
+#else
+    munmap(arena->ptr, arena->cap);
+#endif
+    *arena = (Arena) { 0 };
+}
+
+// Commits pages so that the first `size` bytes of the arena are usable.
+void arena_commit(Arena* arena, size_t size) {
+    if (size <= arena->committed)
+        return;
+
+    size_t target = (size + ARENA_COMMIT_GRANULARITY - 1) & ~(size_t)(ARENA_COMMIT_GRANULARITY - 1);
+    if (target > arena->cap)
+        target = arena->cap;
+
+    u8* start = (u8*)arena->ptr + arena->committed;
+    size_t len = target - arena->committed;
+
+#ifdef _WIN32
+    bool ok = VirtualAlloc(start, len, MEM_COMMIT, PAGE_READWRITE) != 0;
+#else
+    bool ok = mprotect(start, len, PROT_READ | PROT_WRITE) == 0;
+#endif
+
+    if (!ok) {
+        printf("Out of memory: failed to commit %zu bytes.\n", len);
+        exit(1);
+    }
+
+    arena->committed = target;
+}
+
+double time_seconds(void) {
+#ifdef _WIN32
+    LARGE_INTEGER freq, counter;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
@@ -12,6 +12,7 @@ typedef enum {
 
 typedef struct {
     String name;
+    Atom atom;
     u32 size;
     u32 flags;
 } Type;
@@ -29,7 +30,7 @@ extern Type ty_i64;
 extern Type ty_void;
 
 typedef struct {
-    String name;
+    Atom name;
     IRAllocation* allocation;
     Type* type;
 } Symbol;
@@ -63,48 +64,89 @@ typedef enum {
     NUM_AST_KINDS,
 } ASTKind;
 
-typedef struct AST AST;
-struct AST {
-    AST* next;
-    ASTKind kind;
-    Token tok;
+// Nodes live in the arena the source was parsed into, which never moves, and
+// refer to each other by their distance from ASTPool::base in 8 byte units.
+// Ref 0 is the null node.
+typedef u32 ASTRef;
+
+// Header shared by every node. `tok` indexes the pool's token list.
+typedef struct {
+    u8 kind;
+    u32 tok;
     Type* type;
-    union {
-        u64 int_val;
-        struct {
-            Token name;
-            Symbol* sym;
-        } var;
-        struct {
-            AST* expr;
-        } cast;
-        struct {
-            AST* l;
-            AST* r;
-        } bin;
-        struct {
-            AST* first_stmt;
-            int num_locals;
-        } block;
-        AST* return_val;
-        struct {
-            Token name;
-            Token type_name;
-            Token assign_tok;
-            AST* init;
-            Symbol* sym;
-        } var_decl;
-        struct {
-            AST* cond;
-            AST* then;
-            AST* els;
-        } conditional;
-    };
-};
+} AST;
+
+typedef struct {
+    AST base;
+    u64 val;
+} ASTInt;
+
+// The variable's name is its token.
+typedef struct {
+    AST base;
+    Symbol* sym;
+} ASTVar;
+
+typedef struct {
+    AST base;
+    ASTRef expr;
+} ASTCast;
+
+// Binary operators and AST_ASSIGN.
+typedef struct {
+    AST base;
+    ASTRef l;
+    ASTRef r;
+} ASTBin;
+
+typedef struct {
+    AST base;
+    u32 count;
+    ASTRef stmts[1];
+} ASTBlock;
+
+typedef struct {
+    AST base;
+    ASTRef val;
+} ASTReturn;
+
+// The declared name is the node's token.
+typedef struct {
+    AST base;
+    u32 type_name;
+    u32 assign_tok;
+    ASTRef init;
+    Symbol* sym;
+} ASTVarDecl;
+
+// AST_IF and AST_WHILE. `els` is null for loops.
+typedef struct {
+    AST base;
+    ASTRef cond;
+    ASTRef then;
+    ASTRef els;
+} ASTConditional;
+
+typedef struct {
+    Arena* arena;
+    u64* base;
+    char* src;
+    TokenList tokens;
+    ASTRef root;
+    u32 node_count;
+    size_t node_bytes;
+} ASTPool;
 
 typedef struct {
     int    type_table_size;
     Type** type_table;
 } Program;
 
-AST* new_ast(Arena* arena, ASTKind kind, Token tok);
+ASTRef new_ast(ASTPool* pool, ASTKind kind, u32 tok, size_t size);
+
+inline AST* ast_node(ASTPool* pool, ASTRef ref) {
+    return ref ? (AST*)(pool->base + ref) : 0;
+}
+
+// Expands a token index for error reporting.
+Token ast_token(ASTPool* pool, u32 tok);
@@ -20,30 +20,72 @@ typedef int64_t i64;
 #define internal static
 #define LEN(x) (sizeof(x)/sizeof((x)[0]))
 
+#ifndef thread_local
+#ifdef _MSC_VER
+#define thread_local __declspec(thread)
+#else
+#define thread_local _Thread_local
+#endif
+#endif
+
 typedef struct {
     int len;
     char* ptr;
 } String;
 
+// An arena reserves `cap` bytes of address space up front and commits pages
+// as it grows into them, so allocations never move and small compiles only
+// pay for the memory they touch. `peak` is the high-water mark of `used`.
 typedef struct {
     void* ptr;
     size_t cap;
+    size_t committed;
     size_t used;
+    size_t peak;
 } Arena;
 
+// Address space reserved up front. The main arena of a compilation gets
+// ARENA_RESERVE. Scratch, analysis and diagnostic arenas only ever hold a
+// fraction of what the main arena does and get SMALL_ARENA_RESERVE. 32-bit
+// builds have a few GiB of address space in total.
+#if UINTPTR_MAX > 0xffffffff
+#define ARENA_RESERVE ((size_t)16 << 30)
+#define SMALL_ARENA_RESERVE ((size_t)1 << 30)
+#else
+#define ARENA_RESERVE ((size_t)256 << 20)
+#define SMALL_ARENA_RESERVE ((size_t)16 << 20)
+#endif
+
+Arena arena_create(size_t reserve);
+void arena_destroy(Arena* arena);
+void arena_commit(Arena* arena, size_t size);
+
+// Seconds on a monotonic clock, for timing compiler phases.
+double time_seconds(void);
+
 #define arena_pad_size(size) (((size) + 7) & ~7);
 
 inline void* arena_push(Arena* arena, size_t size) {
     size = arena_pad_size(size);
     assert(arena->cap - arena->used >= size);
+
+    if (arena->committed - arena->used < size)
+        arena_commit(arena, arena->used + size);
+
     void* ptr = (u8*)arena->ptr + arena->used;
     arena->used += size;
+
+    if (arena->used > arena->peak)
+        arena->peak = arena->used;
+
     return size ? ptr : 0;
 }
 
 inline void* arena_push_clear(Arena* arena, size_t size) {
+    size = arena_pad_size(size);
     void* ptr = arena_push(arena, size);
-    memset(ptr, 0, size);
+    if (ptr)
+        memset(ptr, 0, size);
     return ptr;
 }
 
@@ -0,0 +1,442 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "batch.h"
+#include "core.h"
+#include "ir_gen.h"
+#include "jit.h"
+#include "opt.h"
+#include "parse.h"
+#include "sem.h"
+#include "stream.h"
+#include "vm.h"
+
+#ifdef _WIN32
+typedef SRWLOCK Mutex;
+#define mutex_init(m) InitializeSRWLock(m)
+#define mutex_lock(m) AcquireSRWLockExclusive(m)
+#define mutex_unlock(m) ReleaseSRWLockExclusive(m)
+#else
+typedef pthread_mutex_t Mutex;
+#define mutex_init(m) pthread_mutex_init((m), 0)
+#define mutex_lock(m) pthread_mutex_lock(m)
+#define mutex_unlock(m) pthread_mutex_unlock(m)
+#endif
+
+typedef enum {
+    BATCH_NOT_RUN,
+    BATCH_LOAD_FAILED,
+    BATCH_COMPILE_FAILED,
+    BATCH_NO_RETURN,
+    BATCH_OK,
+} BatchStatus;
+
+typedef struct {
+    char* path;
+    size_t bytes;
+    BatchStatus status;
+    i64 result;
+    double seconds;
+    char* diagnostics; // Parse and type errors, printed with the results.
+} BatchFile;
+
+// Each worker owns a range of file indices. It takes work from the front of its
+// own range; an idle worker steals the back half of the fullest range it finds.
+typedef struct {
+    Mutex lock;
+    int begin;
+    int end;
+} WorkRange;
+
+typedef struct Batch Batch;
+
+typedef struct {
+    Batch* batch;
+    int index;
+    int compiled;
+    int stolen;
+
+    // Outlives the per-file compile context, until the results are printed.
+    Arena diagnostics;
+} Worker;
+
+struct Batch {
+    BatchFile* files;
+    int worker_count;
+    Worker* workers;
+    WorkRange* ranges;
+    bool use_jit;
+    bool stream;
+};
+
+internal bool take_work(Batch* batch, int self, int* file) {
+    WorkRange* own = &batch->ranges[self];
+
+    mutex_lock(&own->lock);
+    bool found = own->begin < own->end;
+    if (found)
+        *file = own->begin++;
+    mutex_unlock(&own->lock);
+
+    return found;
+}
+
+internal bool steal_work(Batch* batch, int self) {
+    for (;;)
+    {
+        int victim = -1;
+        int victim_size = 0;
+
+        for (int i = 0; i < batch->worker_count; ++i) {
+            if (i == self)
+                continue;
+
+            mutex_lock(&batch->ranges[i].lock);
+            int size = batch->ranges[i].end - batch->ranges[i].begin;
+            mutex_unlock(&batch->ranges[i].lock);
+
+            if (size > victim_size) {
+                victim = i;
+                victim_size = size;
+            }
+        }
+
+        if (victim < 0)
+            return false;
+
+        WorkRange* from = &batch->ranges[victim];
+        int begin = 0, end = 0;
+
+        mutex_lock(&from->lock);
+        int size = from->end - from->begin;
+        if (size > 0) {
+            end = from->end;
+            begin = end - (size + 1) / 2;
+            from->end = begin;
+        }
+        mutex_unlock(&from->lock);
+
+        if (begin == end)
+            continue;
+
+        WorkRange* own = &batch->ranges[self];
+        mutex_lock(&own->lock);
+        own->begin = begin;
+        own->end = end;
+        mutex_unlock(&own->lock);
+
+        batch->workers[self].stolen += end - begin;
+        return true;
+    }
+}
+
+internal char* load_source(Arena* arena, char* path, size_t* len) {
+    FILE* file;
+    if (fopen_s(&file, path, "rb"))
+        return 0;
+
+    fseek(file, 0, SEEK_END);
+    size_t file_len = ftell(file);
+    rewind(file);
+
+    char* src = arena_push(arena, file_len + 1);
+    *len = fread(src, 1, file_len, file);
+    src[*len] = '\0';
+
+    fclose(file);
+    return src;
+}
+
+internal void compile_file(Batch* batch, Arena* arena, BatchFile* f) {
+    double start = time_seconds();
+
+    char* src = load_source(arena, f->path, &f->bytes);
+    if (!src) {
+        f->status = BATCH_LOAD_FAILED;
+        return;
+    }
+
+    f->status = BATCH_COMPILE_FAILED;
+
+    Program prog = program_init(arena);
+    IR ir = { 0 };
+    bool front_end_ok;
+
+    if (batch->stream) {
+        front_end_ok = compile_stream(arena, src, &prog, &ir);
+    }
+    else {
+        ASTPool* ast = parse(arena, src);
+        front_end_ok = ast && sem_ast(arena, &prog, ast);
+        if (front_end_ok)
+            ir = ir_gen(arena, ast);
+    }
+
+    if (front_end_ok)
+    {
+        optimize(arena, &ir, 0);
+
+        bool compiled = true;
+        bool returned = false;
+
+        if (batch->use_jit) {
+            JITProgram jit;
+            compiled = jit_compile(&ir, &jit);
+            if (compiled) {
+                returned = jit_run(&jit, &f->result);
+                jit_free(&jit);
+            }
+        }
+        else {
+            Bytecode bc = lower_ir(arena, &ir, false);
+            returned = vm_run(&bc, &f->result);
+        }
+
+        if (compiled)
+            f->status = returned ? BATCH_OK : BATCH_NO_RETURN;
+    }
+
+    f->seconds = time_seconds() - start;
+}
+
+internal void worker_main(Worker* w) {
+    Batch* batch = w->batch;
+
+    CompileContext ctx = compile_context_create();
+    bind_compile_context(&ctx);
+
+    int file;
+    for (;;)
+    {
+        if (!take_work(batch, w->index, &file)) {
+            if (!steal_work(batch, w->index))
+                break;
+            continue;
+        }
+
+        DiagnosticBuffer diagnostics = { .arena = &w->diagnostics };
+        set_diagnostic_buffer(&diagnostics);
+
+        compile_context_reset(&ctx);
+        compile_file(batch, &ctx.arena, &batch->files[file]);
+        ++w->compiled;
+
+        set_diagnostic_buffer(0);
+        batch->files[file].diagnostics = diagnostics.text;
+    }
+
+    compile_context_destroy(&ctx);
+}
+
+#ifdef _WIN32
+internal DWORD WINAPI worker_thread(LPVOID param) {
+    worker_main(param);
+    return 0;
+}
+#else
+internal void* worker_thread(void* param) {
+    worker_main(param);
+    return 0;
+}
+#endif
+
+int default_thread_count(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+#endif
+}
+
+internal bool has_lang_extension(char* name) {
+    size_t len = strlen(name);
+    return len > 5 && strcmp(name + len - 5, ".lang") == 0;
+}
+
+internal char* join_path(Arena* arena, char* dir, char* name) {
+    size_t dir_len = strlen(dir);
+    size_t name_len = strlen(name);
+
+    char* path = arena_push(arena, dir_len + name_len + 2);
+    memcpy(path, dir, dir_len);
+    path[dir_len] = '/';
+    memcpy(path + dir_len + 1, name, name_len + 1);
+    return path;
+}
+
+// Appends path, or the .lang files inside it if it is a directory. `files` has
+// room for `cap` entries; returns the new count, which may exceed cap.
+internal int gather_files(Arena* arena, char* path, BatchFile* files, int count, int cap) {
+#ifdef _WIN32
+    DWORD attributes = GetFileAttributesA(path);
+    bool is_dir = attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+    struct stat st;
+    bool is_dir = stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+#endif
+
+    if (!is_dir) {
+        if (count < cap)
+            files[count] = (BatchFile) { .path = path };
+        return count + 1;
+    }
+
+#ifdef _WIN32
+    WIN32_FIND_DATAA find;
+    HANDLE handle = FindFirstFileA(join_path(arena, path, "*.lang"), &find);
+    if (handle == INVALID_HANDLE_VALUE)
+        return count;
+
+    do {
+        if (!(find.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && has_lang_extension(find.cFileName)) {
+            if (count < cap)
+                files[count] = (BatchFile) { .path = join_path(arena, path, find.cFileName) };
+            ++count;
+        }
+    } while (FindNextFileA(handle, &find));
+
+    FindClose(handle);
+#else
+    DIR* dir = opendir(path);
+    if (!dir)
+        return count;
+
+    for (struct dirent* entry; (entry = readdir(dir));) {
+        if (has_lang_extension(entry->d_name)) {
+            if (count < cap)
+                files[count] = (BatchFile) { .path = join_path(arena, path, entry->d_name) };
+            ++count;
+        }
+    }
+
+    closedir(dir);
+#endif
+
+    return count;
+}
+
+internal int compare_file_path(const void* a, const void* b) {
+    return strcmp(((BatchFile*)a)->path, ((BatchFile*)b)->path);
+}
+
+internal char* status_name(BatchStatus status) {
+    switch (status) {
+        default:
+            return "not run";
+        case BATCH_LOAD_FAILED:
+            return "failed to load";
+        case BATCH_COMPILE_FAILED:
+            return "failed to compile";
+        case BATCH_NO_RETURN:
+            return "did not return";
+        case BATCH_OK:
+            return "ok";
+    }
+}
+
+int run_batch(char** paths, int path_count, int thread_count, bool use_jit, bool stream) {
+    Scratch scratch = get_scratch(0, 0);
+
+    // Count first, directories may expand to any number of files.
+    int file_count = 0;
+    for (int i = 0; i < path_count; ++i)
+        file_count = gather_files(scratch.arena, paths[i], 0, file_count, 0);
+
+    BatchFile* files = arena_push_array(scratch.arena, BatchFile, file_count);
+    int gathered = 0;
+    for (int i = 0; i < path_count; ++i)
+        gathered = gather_files(scratch.arena, paths[i], files, gathered, file_count);
+
+    file_count = gathered < file_count ? gathered : file_count;
+    qsort(files, file_count, sizeof(BatchFile), compare_file_path);
+
+    if (thread_count < 1)
+        thread_count = 1;
+    if (thread_count > file_count)
+        thread_count = file_count > 0 ? file_count : 1;
+
+    Batch batch = {
+        .files = files,
+        .worker_count = thread_count,
+        .workers = arena_push_array(scratch.arena, Worker, thread_count),
+        .ranges = arena_push_array(scratch.arena, WorkRange, thread_count),
+        .use_jit = use_jit,
+        .stream = stream,
+    };
+
+    for (int i = 0; i < thread_count; ++i) {
+        batch.workers[i] = (Worker) { .batch = &batch, .index = i, .diagnostics = arena_create(SMALL_ARENA_RESERVE) };
+        mutex_init(&batch.ranges[i].lock);
+        batch.ranges[i].begin = (int)((i64)file_count * i / thread_count);
+        batch.ranges[i].end = (int)((i64)file_count * (i + 1) / thread_count);
+    }
+
+    double start = time_seconds();
+
+#ifdef _WIN32
+    HANDLE* threads = arena_push_array(scratch.arena, HANDLE, thread_count);
+    for (int i = 0; i < thread_count; ++i)
+        threads[i] = CreateThread(0, 0, worker_thread, &batch.workers[i], 0, 0);
+
+    for (int i = 0; i < thread_count; ++i) {
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+    }
+#else
+    pthread_t* threads = arena_push_array(scratch.arena, pthread_t, thread_count);
+    for (int i = 0; i < thread_count; ++i)
+        pthread_create(&threads[i], 0, worker_thread, &batch.workers[i]);
+
+    for (int i = 0; i < thread_count; ++i)
+        pthread_join(threads[i], 0);
+#endif
+
+    double elapsed = time_seconds() - start;
+
+    int failed = 0;
+    size_t total_bytes = 0;
+
+    for (int i = 0; i < file_count; ++i)
+    {
+        BatchFile* f = &files[i];
+        total_bytes += f->bytes;
+
+        if (f->status == BATCH_OK) {
+            printf("%s: ok, result %lld (%.3f ms)\n", f->path, f->result, f->seconds * 1000.0);
+        }
+        else {
+            printf("%s: %s\n", f->path, status_name(f->status));
+            ++failed;
+        }
+
+        if (f->diagnostics)
+            printf("%s", f->diagnostics);
+    }
+
+    printf("\n");
+    for (int i = 0; i < thread_count; ++i) {
+        printf("Worker %d: %d files, %d stolen\n", i, batch.workers[i].compiled, batch.workers[i].stolen);
+        arena_destroy(&batch.workers[i].diagnostics);
+    }
+
+    double mb = (double)total_bytes / (1024.0 * 1024.0);
+    printf("%d files (%d failed), %.2f MB in %.3f s on %d threads\n", file_count, failed, mb, elapsed, thread_count);
+    printf("%.1f files/sec, %.2f MB/sec\n", elapsed > 0 ? file_count / elapsed : 0.0, elapsed > 0 ? mb / elapsed : 0.0);
+
+    release_scratch(&scratch);
+    return failed;
+}
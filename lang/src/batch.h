@@ -0,0 +1,12 @@
+#pragma once
+
+#include "base.h"
+
+// Compiles and runs every .lang file in `paths` (directories are expanded to
+// the .lang files directly inside them) on `thread_count` workers, then prints
+// a line per file, followed by its diagnostics, and the aggregate throughput.
+// `stream` compiles with the fused front end. Returns the number of files
+// that failed.
+int run_batch(char** paths, int path_count, int thread_count, bool use_jit, bool stream);
+
+int default_thread_count(void);
@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "bench.h"
+
+#define BENCH_VARS 8
+#define BENCH_MAX_DEPTH 4
+
+typedef struct {
+    char* buf;
+    size_t len;
+    size_t cap;
+    u32 rng;
+    int remaining;
+    int next_counter;
+} BenchGen;
+
+internal u32 bench_rand(BenchGen* g, u32 n) {
+    g->rng ^= g->rng << 13;
+    g->rng ^= g->rng >> 17;
+    g->rng ^= g->rng << 5;
+    return g->rng % n;
+}
+
+internal void bench_emit(BenchGen* g, int depth, char* fmt, ...) {
+    assert(g->cap - g->len > 256);
+
+    for (int i = 0; i < depth + 1; ++i) {
+        memcpy(g->buf + g->len, "    ", 4);
+        g->len += 4;
+    }
+
+    va_list args;
+    va_start(args, fmt);
+    g->len += vsnprintf(g->buf + g->len, g->cap - g->len, fmt, args);
+    va_end(args);
+
+    g->buf[g->len++] = '\n';
+}
+
+internal void bench_block(BenchGen* g, int depth, int count) {
+    for (int i = 0; i < count && g->remaining > 0; ++i)
+    {
+        --g->remaining;
+
+        u32 a = bench_rand(g, BENCH_VARS);
+        u32 b = bench_rand(g, BENCH_VARS);
+        u32 c = bench_rand(g, BENCH_VARS);
+
+        u32 kind = depth < BENCH_MAX_DEPTH ? bench_rand(g, 10) : 0;
+
+        if (kind < 6) {
+            bench_emit(g, depth, "v%u = v%u + v%u * %u;", a, b, c, bench_rand(g, 16));
+        }
+        else if (kind < 9) {
+            bench_emit(g, depth, "if v%u < v%u {", a, b);
+            bench_block(g, depth + 1, 1 + bench_rand(g, 4));
+            bench_emit(g, depth, "} else {");
+            bench_block(g, depth + 1, 1 + bench_rand(g, 4));
+            bench_emit(g, depth, "}");
+        }
+        else {
+            int counter = g->next_counter++;
+            bench_emit(g, depth, "c%d: i64 = 0;", counter);
+            bench_emit(g, depth, "while c%d < 2 {", counter);
+            bench_block(g, depth + 1, 1 + bench_rand(g, 4));
+            bench_emit(g, depth + 1, "c%d = c%d + 1;", counter, counter);
+            bench_emit(g, depth, "}");
+        }
+    }
+}
+
+char* generate_bench_source(Arena* arena, int statements, u32 seed) {
+    BenchGen g = {
+        .cap = (size_t)(statements + BENCH_VARS + 16) * 64,
+        .rng = seed ? seed : 1,
+        .remaining = statements,
+    };
+
+    g.buf = arena_push(arena, g.cap);
+
+    g.buf[g.len++] = '{';
+    g.buf[g.len++] = '\n';
+
+    for (int i = 0; i < BENCH_VARS; ++i)
+        bench_emit(&g, 0, "v%d: i64 = %d;", i, i + 1);
+
+    while (g.remaining > 0)
+        bench_block(&g, 0, g.remaining);
+
+    bench_emit(&g, 0, "return v0 + v1 + v2 + v3 + v4 + v5 + v6 + v7;");
+
+    g.buf[g.len++] = '}';
+    g.buf[g.len++] = '\0';
+
+    arena_realloc(arena, g.buf, g.len);
+    return g.buf;
+}
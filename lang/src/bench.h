@@ -0,0 +1,7 @@
+#pragma once
+
+#include "base.h"
+
+// Generates a program of roughly `statements` statements spread over nested
+// ifs and loops, for timing the compiler on large CFGs.
+char* generate_bench_source(Arena* arena, int statements, u32 seed);
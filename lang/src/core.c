@@ -0,0 +1,83 @@
+#include "core.h"
+
+internal thread_local CompileContext* bound_context;
+
+CompileContext compile_context_create(void) {
+    CompileContext ctx = {
+        .arena = arena_create(ARENA_RESERVE),
+    };
+
+    for (int i = 0; i < SCRATCH_ARENA_COUNT; ++i)
+        ctx.scratch_arenas[i] = arena_create(SMALL_ARENA_RESERVE);
+
+    ctx.cfg_arena = arena_create(SMALL_ARENA_RESERVE);
+    ctx.instrs_arena = arena_create(SMALL_ARENA_RESERVE);
+
+    return ctx;
+}
+
+// Drops everything allocated for the last compilation but keeps the committed
+// pages, so the next compilation on this context doesn't fault them in again.
+void compile_context_reset(CompileContext* ctx) {
+    ctx->arena.used = 0;
+    for (int i = 0; i < SCRATCH_ARENA_COUNT; ++i)
+        ctx->scratch_arenas[i].used = 0;
+
+    ctx->cfg_arena.used = 0;
+    ctx->instrs_arena.used = 0;
+    ctx->analysis_owner = 0;
+}
+
+void compile_context_destroy(CompileContext* ctx) {
+    if (bound_context == ctx)
+        bound_context = 0;
+
+    arena_destroy(&ctx->arena);
+    for (int i = 0; i < SCRATCH_ARENA_COUNT; ++i)
+        arena_destroy(&ctx->scratch_arenas[i]);
+
+    arena_destroy(&ctx->cfg_arena);
+    arena_destroy(&ctx->instrs_arena);
+}
+
+void bind_compile_context(CompileContext* ctx) {
+    bound_context = ctx;
+}
+
+CompileContext* get_compile_context(void) {
+    assert(bound_context && "no compile context bound to this thread");
+    return bound_context;
+}
+
+Scratch get_scratch(Arena** conflicts, int conflict_count) {
+    assert(bound_context && "no compile context bound to this thread");
+    Arena* scratch_arenas = bound_context->scratch_arenas;
+
+    for (int i = 0; i < SCRATCH_ARENA_COUNT; ++i)
+    {
+        bool does_conflict = false;
+
+        for (int j = 0; j < conflict_count; ++j)
+        {
+            if (&scratch_arenas[i] == conflicts[j]) {
+                does_conflict = true;
+                break;
+            }
+        }
+    
+        if (!does_conflict) {
+            return (Scratch) {
+                .arena = scratch_arenas + i,
+                .used = scratch_arenas[i].used
+            };
+        }
+    }
+
+    assert(false && "all scratch arenas conflict!");
+    return (Scratch) { 0 };
+}
+
+void release_scratch(Scratch* scratch) {
+    assert(scratch->arena->used >= scratch->used);
+    scratch->arena->used = scratch->used;
+}
@@ -7,5 +7,29 @@ typedef struct {
     size_t used;
 } Scratch ;
 
+#define SCRATCH_ARENA_COUNT 3
+
+// Everything a compilation allocates from. Each thread compiles with its own
+// context, and get_scratch() hands out the scratch arenas of the context bound
+// to the calling thread.
+typedef struct {
+    Arena arena;
+    Arena scratch_arenas[SCRATCH_ARENA_COUNT];
+
+    // Backing for the IR analysis cache, which rewinds them when it recomputes
+    // instead of growing the main arena. See IRAnalysis. Only one cache can
+    // use them between resets, and analysis_owner records which.
+    Arena cfg_arena;
+    Arena instrs_arena;
+    struct IRAnalysis* analysis_owner;
+} CompileContext;
+
+CompileContext compile_context_create(void);
+void compile_context_reset(CompileContext* ctx);
+void compile_context_destroy(CompileContext* ctx);
+
+void bind_compile_context(CompileContext* ctx);
+CompileContext* get_compile_context(void);
+
 Scratch get_scratch(Arena** conflicts, int conflict_count);
 void release_scratch(Scratch* scratch);
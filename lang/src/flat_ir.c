@@ -0,0 +1,97 @@
+#include "flat_ir.h"
+
+internal u64 flat_operand_val(IRValue* v) {
+    switch (v->kind) {
+        default:
+            assert(false);
+            return 0;
+        case IR_VALUE_REG:
+            return v->reg;
+        case IR_VALUE_INTEGER:
+            return v->integer;
+        case IR_VALUE_ALLOCATION:
+            return (u64)v->allocation->id;
+    }
+}
+
+FlatIR flatten_ir(Arena* arena, IR* ir) {
+    FlatIR f = { 0 };
+
+    f.block_count = (u32)ir_block_count(ir);
+    f.block_first = arena_push_array(arena, u32, f.block_count);
+    f.block_len   = arena_push_array(arena, u32, f.block_count);
+
+    FOREACH_IR_BB(b, ir->first_block)
+    {
+        f.instr_count += b->len;
+
+        IRInstr* instr = b->start;
+        for (int i = 0; i < b->len; ++i)
+        {
+            IRValue* operands[2];
+            f.operand_count += instr->op == IR_OP_PHI ? instr->phi.param_count : ir_instr_operands(instr, operands);
+            instr = instr->next;
+        }
+    }
+
+    f.op             = arena_push_array(arena, u8, f.instr_count);
+    f.type           = arena_push_array(arena, u8, f.instr_count);
+    f.dest           = arena_push_array(arena, IRReg, f.instr_count);
+    f.block          = arena_push_array(arena, u32, f.instr_count);
+    f.operand_offset = arena_push_array(arena, u32, f.instr_count + 1);
+    f.node           = arena_push_array(arena, IRInstr*, f.instr_count);
+
+    f.operand_kind  = arena_push_array(arena, u8, f.operand_count);
+    f.operand_val   = arena_push_array(arena, u64, f.operand_count);
+    f.operand_block = arena_push_array(arena, i32, f.operand_count);
+
+    u32 n = 0;
+    u32 k = 0;
+
+    FOREACH_IR_BB(b, ir->first_block)
+    {
+        f.block_first[b->id] = n;
+        f.block_len[b->id] = (u32)b->len;
+
+        IRInstr* instr = b->start;
+        for (int i = 0; i < b->len; ++i)
+        {
+            IRReg* dest = ir_instr_dest(instr);
+
+            f.op[n]             = (u8)instr->op;
+            f.type[n]           = (u8)ir_instr_type(instr);
+            f.dest[n]           = dest ? *dest : IR_EMPTY_REG;
+            f.block[n]          = (u32)b->id;
+            f.operand_offset[n] = k;
+            f.node[n]           = instr;
+
+            if (instr->op == IR_OP_PHI) {
+                for (int j = 0; j < instr->phi.param_count; ++j) {
+                    IRPhiParam* param = &instr->phi.params[j];
+                    f.operand_kind[k]  = param->reg == IR_EMPTY_REG ? IR_VALUE_ILLEGAL : IR_VALUE_REG;
+                    f.operand_val[k]   = param->reg;
+                    f.operand_block[k] = param->block->id;
+                    ++k;
+                }
+            }
+            else {
+                IRValue* operands[2];
+                int operand_count = ir_instr_operands(instr, operands);
+                for (int j = 0; j < operand_count; ++j) {
+                    f.operand_kind[k]  = (u8)operands[j]->kind;
+                    f.operand_val[k]   = flat_operand_val(operands[j]);
+                    f.operand_block[k] = -1;
+                    ++k;
+                }
+            }
+
+            ++n;
+            instr = instr->next;
+        }
+    }
+
+    assert(n == f.instr_count && k == f.operand_count);
+    f.operand_offset[n] = k;
+
+    return f;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "ir.h"
+
+// Structure-of-arrays copy of an IR. Instructions are numbered in layout order
+// and every column is indexed by that number, so whole-program sweeps read
+// small contiguous arrays instead of chasing IRInstr nodes.
+//
+// The operands of instruction i are operand_*[operand_offset[i]..operand_offset[i+1]],
+// in the order ir_instr_operands() returns them. Phi parameters are operands
+// too: their kind is IR_VALUE_REG, or IR_VALUE_ILLEGAL for an empty parameter,
+// and operand_block holds the incoming block id. operand_block is -1 otherwise.
+typedef struct {
+    u32 instr_count;
+    u8* op;
+    u8* type;
+    IRReg* dest;
+    u32* block;
+    u32* operand_offset;
+    IRInstr** node;
+
+    u32 operand_count;
+    u8* operand_kind;
+    u64* operand_val; // Register, integer, or allocation id.
+    i32* operand_block;
+
+    // Instructions of block b are block_first[b]..block_first[b] + block_len[b].
+    u32 block_count;
+    u32* block_first;
+    u32* block_len;
+} FlatIR;
+
+FlatIR flatten_ir(Arena* arena, IR* ir);
@@ -9,8 +9,8 @@ BBList bb_get_succ(IRBasicBlock* block) {
     if (block->len > 0) {
         switch (block->end->op) {
             default:
-                if (block->end->next)
-                    succ.data[succ.count++] = block->end->next->block;
+                if (block->next)
+                    succ.data[succ.count++] = block->next;
                 break;
             case IR_OP_RET:
                 break;
@@ -24,22 +24,25 @@ BBList bb_get_succ(IRBasicBlock* block) {
         }
     }
     else {
-        if (block->start) {
-            succ.data[succ.count++] = block->start->block;
+        if (block->next) {
+            succ.data[succ.count++] = block->next;
         }
     }
 
     return succ;
 }
 
-void bb_update_end(IRBasicBlock* block) {
-    if (block->len > 0) {
-        block->end = block->start;
-        for (int i = 1; i < block->len; ++i)
-            block->end = block->end->next;
-    }
-    else {
-        block->end = 0;
+bool bb_is_terminated(IRBasicBlock* b) {
+    if (b->len == 0)
+        return false;
+
+    switch (b->end->op) {
+        default:
+            return false;
+        case IR_OP_RET:
+        case IR_OP_JMP:
+        case IR_OP_BRANCH:
+            return true;
     }
 }
 
@@ -65,7 +68,7 @@ internal void print_value(IRValue value) {
 }
 
 internal char* get_type_name(IRType type) {
-    static_assert(NUM_IR_TYPES == 5, "not all ir types handled");
+    static_assert(NUM_IR_TYPES == 9, "not all ir types handled");
     switch (type) {
         default:
             assert(false);
@@ -78,191 +81,183 @@ internal char* get_type_name(IRType type) {
             return "i32";
         case IR_TYPE_I64:
             return "i64";
+        case IR_TYPE_U8:
+            return "u8";
+        case IR_TYPE_U16:
+            return "u16";
+        case IR_TYPE_U32:
+            return "u32";
+        case IR_TYPE_U64:
+            return "u64";
     }
 }
 
+bool ir_type_is_signed(IRType type) {
+    static_assert(NUM_IR_TYPES == 9, "not all ir types handled");
+    return type >= IR_TYPE_I8 && type <= IR_TYPE_I64;
+}
+
 void print_ir(IR* ir) {
-    for (IRInstr* instr = ir->first_instr; instr; instr = instr->next)
-    {
-        if (instr->block->start == instr) {
-            FOREACH_IR_BB(b, ir->first_block) {
-                if (b->start == instr)
-                    printf("bb.%d:\n", b->id);
+    FOREACH_IR_BB(b, ir->first_block) {
+        printf("bb.%d:\n", b->id);
+
+        FOREACH_IR_INSTR(instr, b) {
+            static_assert(NUM_IR_OPS == 19, "not all ir ops handled");
+            switch (instr->op) {
+                case IR_OP_PHI:
+                    printf("  ");
+                    print_reg(instr->phi.dest);
+                    printf(" = phi %s", get_type_name(instr->phi.type));
+                    for (int i = 0; i < instr->phi.param_count; ++i) {
+                        IRPhiParam param = instr->phi.params[i];
+
+                        if (i != 0)
+                            printf(",");
+
+                        printf(" [%%%d, bb.%d]", param.reg, param.block->id);
+                    }
+                    printf("\n");
+                    break;
+
+                case IR_OP_COPY:
+                    printf("  ");
+                    print_reg(instr->copy.dest);
+                    printf(" = copy %s ", get_type_name(instr->copy.type));
+                    print_value(instr->copy.src);
+                    printf("\n");
+                    break;
+
+                case IR_OP_LOAD:
+                    printf("  ");
+                    print_reg(instr->load.dest);
+                    printf(" = load %s ", get_type_name(instr->load.type));
+                    print_value(instr->load.loc);
+                    printf("\n");
+                    break;
+                
+                case IR_OP_STORE:
+                    printf("  store %s ", get_type_name(instr->store.type));
+                    print_value(instr->store.loc);
+                    printf(", ");
+                    print_value(instr->store.src);
+                    printf("\n");
+                    break;
+
+                case IR_OP_SEXT:
+                case IR_OP_ZEXT:
+                case IR_OP_TRUNC:
+                {
+                    char* name = 0;
+                    switch (instr->op) {
+                        case IR_OP_SEXT:
+                            name = "sext";
+                            break;
+                        case IR_OP_ZEXT:
+                            name = "zext";
+                            break;
+                        case IR_OP_TRUNC:
+                            name = "trunc";
+                            break;
+                    }
+
+                    printf("  ");
+                    print_reg(instr->cast.dest);
+                    printf(" = %s %s ", name, get_type_name(instr->cast.type_src));
+                    print_value(instr->cast.src);
+                    printf(" to %s\n", get_type_name(instr->cast.type_dest));
+                } break;
+
+                case IR_OP_ADD:
+                case IR_OP_SUB:
+                case IR_OP_MUL:
+                case IR_OP_DIV:
+                case IR_OP_LESS:
+                case IR_OP_LEQUAL:
+                case IR_OP_NEQUAL:
+                case IR_OP_EQUAL:
+                {
+                    printf("  ");
+                    print_reg(instr->bin.dest);
+
+                    char* op_str = 0;
+                    switch (instr->op) {
+                        case IR_OP_ADD:
+                            op_str = "add";
+                            break;
+                        case IR_OP_SUB:
+                            op_str = "sub";
+                            break;
+                        case IR_OP_MUL:
+                            op_str = "mul";
+                            break;
+                        case IR_OP_DIV:
+                            op_str = "div";
+                            break;
+                        case IR_OP_LESS:
+                            op_str = "cmp lt";
+                            break;
+                        case IR_OP_LEQUAL:
+                            op_str = "cmp le";
+                            break;
+                        case IR_OP_NEQUAL:
+                            op_str = "cmp ne";
+                            break;
+                        case IR_OP_EQUAL:
+                            op_str = "cmp eq";
+                            break;
+                    }
+
+                    printf(" = %s %s ", op_str, get_type_name(instr->bin.type));
+                    print_value(instr->bin.l);
+                    printf(", ");
+                    print_value(instr->bin.r);
+                    printf("\n");
+                } break;
+
+                case IR_OP_RET:
+                    printf("  ret %s ", get_type_name(instr->ret.type));
+                    print_value(instr->ret.val);
+                    printf("\n");
+                    break;
+
+                case IR_OP_JMP:
+                    printf("  jmp bb.%d\n", instr->jmp_loc->id);
+                    break;
+
+                case IR_OP_BRANCH:
+                    printf("  branch %s ", get_type_name(instr->branch.type));
+                    print_value(instr->branch.cond);
+                    printf(", bb.%d, bb.%d\n", instr->branch.then_loc->id, instr->branch.els_loc->id);
+                    break;
             }
         }
-
-        static_assert(NUM_IR_OPS == 19, "not all ir ops handled");
-        switch (instr->op) {
-            case IR_OP_PHI:
-                printf("  ");
-                print_reg(instr->phi.dest);
-                printf(" = phi %s", get_type_name(instr->phi.type));
-                for (int i = 0; i < instr->phi.param_count; ++i) {
-                    IRPhiParam param = instr->phi.params[i];
-
-                    if (i != 0)
-                        printf(",");
-
-                    printf(" [%%%d, bb.%d]", param.reg, param.block->id);
-                }
-                printf("\n");
-                break;
-
-            case IR_OP_COPY:
-                printf("  ");
-                print_reg(instr->copy.dest);
-                printf(" = copy %s ", get_type_name(instr->copy.type));
-                print_value(instr->copy.src);
-                printf("\n");
-                break;
-
-            case IR_OP_LOAD:
-                printf("  ");
-                print_reg(instr->load.dest);
-                printf(" = load %s ", get_type_name(instr->load.type));
-                print_value(instr->load.loc);
-                printf("\n");
-                break;
-            
-            case IR_OP_STORE:
-                printf("  store %s ", get_type_name(instr->store.type));
-                print_value(instr->store.loc);
-                printf(", ");
-                print_value(instr->store.src);
-                printf("\n");
-                break;
-
-            case IR_OP_SEXT:
-            case IR_OP_ZEXT:
-            case IR_OP_TRUNC:
-            {
-                char* name = 0;
-                switch (instr->op) {
-                    case IR_OP_SEXT:
-                        name = "sext";
-                        break;
-                    case IR_OP_ZEXT:
-                        name = "zext";
-                        break;
-                    case IR_OP_TRUNC:
-                        name = "trunc";
-                        break;
-                }
-
-                printf("  ");
-                print_reg(instr->cast.dest);
-                printf(" = %s %s ", name, get_type_name(instr->cast.type_src));
-                print_value(instr->cast.src);
-                printf(" to %s\n", get_type_name(instr->cast.type_dest));
-            } break;
-
-            case IR_OP_ADD:
-            case IR_OP_SUB:
-            case IR_OP_MUL:
-            case IR_OP_DIV:
-            case IR_OP_LESS:
-            case IR_OP_LEQUAL:
-            case IR_OP_NEQUAL:
-            case IR_OP_EQUAL:
-            {
-                printf("  ");
-                print_reg(instr->bin.dest);
-
-                char* op_str = 0;
-                switch (instr->op) {
-                    case IR_OP_ADD:
-                        op_str = "add";
-                        break;
-                    case IR_OP_SUB:
-                        op_str = "sub";
-                        break;
-                    case IR_OP_MUL:
-                        op_str = "mul";
-                        break;
-                    case IR_OP_DIV:
-                        op_str = "div";
-                        break;
-                    case IR_OP_LESS:
-                        op_str = "cmp lt";
-                        break;
-                    case IR_OP_LEQUAL:
-                        op_str = "cmp le";
-                        break;
-                    case IR_OP_NEQUAL:
-                        op_str = "cmp ne";
-                        break;
-                    case IR_OP_EQUAL:
-                        op_str = "cmp eq";
-                        break;
-                }
-
-                printf(" = %s %s ", op_str, get_type_name(instr->bin.type));
-                print_value(instr->bin.l);
-                printf(", ");
-                print_value(instr->bin.r);
-                printf("\n");
-            } break;
-
-            case IR_OP_RET:
-                printf("  ret %s ", get_type_name(instr->ret.type));
-                print_value(instr->ret.val);
-                printf("\n");
-                break;
-
-            case IR_OP_JMP:
-                printf("  jmp bb.%d\n", instr->jmp_loc->id);
-                break;
-
-            case IR_OP_BRANCH:
-                printf("  branch %s ", get_type_name(instr->branch.type));
-                print_value(instr->branch.cond);
-                printf(", bb.%d, bb.%d\n", instr->branch.then_loc->id, instr->branch.els_loc->id);
-                break;
-        }
-    }
-
-    FOREACH_IR_BB(b, ir->first_block) {
-        if (!b->start)
-            printf("bb.%d:\n", b->id);
     }
 
     printf("\n");
 }
 
-void remove_ir_instr(IR* ir, IRInstr* instr) {
+void remove_ir_instr(IRInstr* instr) {
+    IRBasicBlock* b = instr->block;
+
     if (instr->prev)
         instr->prev->next = instr->next;
     else
-        ir->first_instr = instr->next;
+        b->start = instr->next;
 
     if (instr->next)
         instr->next->prev = instr->prev;
-    
-    if (instr->block->start == instr) {
-        FOREACH_IR_BB(b, ir->first_block) {
-            if (b->start == instr) {
-                assert(b == instr->block || b->len == 0);
-                b->start = instr->next;
-            }
-        }
-    }
+    else
+        b->end = instr->prev;
 
-    instr->block->len--;
-    bb_update_end(instr->block);
-}
+    instr->prev = 0;
+    instr->next = 0;
 
-void insert_ir_instr_before(IR* ir, IRInstr* after, IRInstr* instr) {
-    instr->block = after->block;
+    b->len--;
+}
 
-    if (after->block->start == after) {
-        for (IRBasicBlock* b = ir->first_block; b; b = b->next)
-        {
-            if (b->start == after) {
-                assert(b == instr->block || b->len == 0);
-                b->start = instr;
-            }
-        }
-    }
+void insert_ir_instr_before(IRInstr* after, IRInstr* instr) {
+    IRBasicBlock* b = after->block;
+    instr->block = b;
 
     instr->next = after;
     instr->prev = after->prev;
@@ -270,55 +265,53 @@ void insert_ir_instr_before(IR* ir, IRInstr* after, IRInstr* instr) {
     if (after->prev)
         after->prev->next = instr;
     else
-        ir->first_instr = instr;
+        b->start = instr;
 
     after->prev = instr;
 
-    instr->block->len++;
-    bb_update_end(instr->block);
+    b->len++;
 }
 
-void insert_ir_instr_at_block_start(IR* ir, IRBasicBlock* b, IRInstr* instr) {
+void insert_ir_instr_after(IRInstr* before, IRInstr* instr) {
+    IRBasicBlock* b = before->block;
     instr->block = b;
-    instr->next = b->start;
 
-    if (b->start) {
-        instr->prev = b->start->prev;
-        b->start->prev = instr;
-    }
-    else {
-        if (ir->first_instr) {
-            IRInstr* last = ir->first_instr;
+    instr->prev = before;
+    instr->next = before->next;
 
-            while (last->next)
-                last = last->next;
+    if (before->next)
+        before->next->prev = instr;
+    else
+        b->end = instr;
 
-            instr->prev = last;
-        }
-        else {
-            instr->prev = 0;
-        }
-    }
+    before->next = instr;
 
-    if (instr->prev)
-        instr->prev->next = instr;
-    else
-        ir->first_instr = instr;
+    b->len++;
+}
 
-    for (IRBasicBlock* a = ir->first_block; a; a = a->next) {
-        if (a->start == b->start) {
-            assert(a == b || a->len == 0);
-            a->start = instr;
-        }
+void insert_ir_instr_at_block_start(IRBasicBlock* b, IRInstr* instr) {
+    if (b->start) {
+        insert_ir_instr_before(b->start, instr);
+        return;
     }
 
-    b->len++;
-    bb_update_end(instr->block);
+    instr->block = b;
+    instr->prev = 0;
+    instr->next = 0;
+
+    b->start = instr;
+    b->end = instr;
+    b->len = 1;
+}
+
+void append_ir_instr(IRBasicBlock* b, IRInstr* instr) {
+    if (b->end)
+        insert_ir_instr_after(b->end, instr);
+    else
+        insert_ir_instr_at_block_start(b, instr);
 }
 
-void output_cfg_graphviz(IR* ir, char* path) {
-    (void)ir;
-    
+void output_cfg_graphviz(IR* ir, char* path, u64* block_counts, u64* edge_counts) {
     FILE* file;
     if (fopen_s(&file, path, "w")) {
         assert(false);
@@ -326,10 +319,31 @@ void output_cfg_graphviz(IR* ir, char* path) {
 
     fprintf(file, "digraph G {\n");
 
+    // With counts, blocks are labelled and shaded from white to red by how
+    // often they ran relative to the hottest one.
+    if (block_counts) {
+        u64 max_count = 1;
+        FOREACH_IR_BB(b, ir->first_block)
+            max_count = block_counts[b->id] > max_count ? block_counts[b->id] : max_count;
+
+        fprintf(file, "  node [style=filled]\n");
+        FOREACH_IR_BB(b, ir->first_block) {
+            double heat = (double)block_counts[b->id] / (double)max_count;
+            fprintf(file, "  bb%d [label=\"bb.%d\\n%llu\", fillcolor=\"0.0 %.3f 1.0\"]\n",
+                    b->id, b->id, block_counts[b->id], heat);
+        }
+    }
+
     FOREACH_IR_BB(b, ir->first_block) {
         BBList succ = bb_get_succ(b);
         for (int i = 0; i < succ.count; ++i) {
-            fprintf(file, "  bb%d -> bb%d\n", b->id, succ.data[i]->id);
+            if (edge_counts) {
+                fprintf(file, "  bb%d -> bb%d [label=\"%llu\"]\n", b->id, succ.data[i]->id,
+                        edge_counts[b->id * 2 + i]);
+            }
+            else {
+                fprintf(file, "  bb%d -> bb%d\n", b->id, succ.data[i]->id);
+            }
         }
     }
 
@@ -338,6 +352,150 @@ void output_cfg_graphviz(IR* ir, char* path) {
     fclose(file);
 }
 
+int ir_block_count(IR* ir) {
+    int max_bb_id = -1;
+    FOREACH_IR_BB(b, ir->first_block)
+        max_bb_id = b->id > max_bb_id ? b->id : max_bb_id;
+    return max_bb_id + 1;
+}
+
+int ir_instr_count(IR* ir) {
+    int count = 0;
+    FOREACH_IR_BB(b, ir->first_block)
+        count += b->len;
+    return count;
+}
+
+int ir_allocation_count(IR* ir) {
+    int max_alloc_id = -1;
+    for (IRAllocation* a = ir->first_allocation; a; a = a->next)
+        max_alloc_id = a->id > max_alloc_id ? a->id : max_alloc_id;
+    return max_alloc_id + 1;
+}
+
+// The type of the value an instruction produces or consumes. Casts report
+// their destination type; jumps have none.
+IRType ir_instr_type(IRInstr* instr) {
+    static_assert(NUM_IR_OPS == 19, "not all ir ops handled");
+    switch (instr->op) {
+        default:
+            return IR_TYPE_ILLEGAL;
+
+        case IR_OP_PHI:
+            return instr->phi.type;
+
+        case IR_OP_COPY:
+            return instr->copy.type;
+
+        case IR_OP_LOAD:
+            return instr->load.type;
+
+        case IR_OP_STORE:
+            return instr->store.type;
+
+        case IR_OP_SEXT:
+        case IR_OP_ZEXT:
+        case IR_OP_TRUNC:
+            return instr->cast.type_dest;
+
+        case IR_OP_ADD:
+        case IR_OP_SUB:
+        case IR_OP_MUL:
+        case IR_OP_DIV:
+        case IR_OP_LESS:
+        case IR_OP_LEQUAL:
+        case IR_OP_NEQUAL:
+        case IR_OP_EQUAL:
+            return instr->bin.type;
+
+        case IR_OP_RET:
+            return instr->ret.type;
+
+        case IR_OP_BRANCH:
+            return instr->branch.type;
+    }
+}
+
+IRReg* ir_instr_dest(IRInstr* instr) {
+    static_assert(NUM_IR_OPS == 19, "not all ir ops handled");
+    switch (instr->op) {
+        default:
+            return 0;
+
+        case IR_OP_PHI:
+            return &instr->phi.dest;
+
+        case IR_OP_COPY:
+            return &instr->copy.dest;
+
+        case IR_OP_LOAD:
+            return &instr->load.dest;
+
+        case IR_OP_SEXT:
+        case IR_OP_ZEXT:
+        case IR_OP_TRUNC:
+            return &instr->cast.dest;
+
+        case IR_OP_ADD:
+        case IR_OP_SUB:
+        case IR_OP_MUL:
+        case IR_OP_DIV:
+        case IR_OP_LESS:
+        case IR_OP_LEQUAL:
+        case IR_OP_NEQUAL:
+        case IR_OP_EQUAL:
+            return &instr->bin.dest;
+    }
+}
+
+// Phi parameters are not IRValues and are not returned here.
+int ir_instr_operands(IRInstr* instr, IRValue** operands) {
+    static_assert(NUM_IR_OPS == 19, "not all ir ops handled");
+    switch (instr->op) {
+        default:
+            return 0;
+
+        case IR_OP_COPY:
+            operands[0] = &instr->copy.src;
+            return 1;
+
+        case IR_OP_LOAD:
+            operands[0] = &instr->load.loc;
+            return 1;
+
+        case IR_OP_STORE:
+            operands[0] = &instr->store.loc;
+            operands[1] = &instr->store.src;
+            return 2;
+
+        case IR_OP_SEXT:
+        case IR_OP_ZEXT:
+        case IR_OP_TRUNC:
+            operands[0] = &instr->cast.src;
+            return 1;
+
+        case IR_OP_ADD:
+        case IR_OP_SUB:
+        case IR_OP_MUL:
+        case IR_OP_DIV:
+        case IR_OP_LESS:
+        case IR_OP_LEQUAL:
+        case IR_OP_NEQUAL:
+        case IR_OP_EQUAL:
+            operands[0] = &instr->bin.l;
+            operands[1] = &instr->bin.r;
+            return 2;
+
+        case IR_OP_RET:
+            operands[0] = &instr->ret.val;
+            return 1;
+
+        case IR_OP_BRANCH:
+            operands[0] = &instr->branch.cond;
+            return 1;
+    }
+}
+
 IRInstr* new_ir_instr(Arena* arena, IROpCode op) {
     assert(op);
     IRInstr* instr = arena_push_type(arena, IRInstr);
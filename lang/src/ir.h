@@ -13,6 +13,11 @@ typedef enum {
     IR_TYPE_I32,
     IR_TYPE_I64,
 
+    IR_TYPE_U8,
+    IR_TYPE_U16,
+    IR_TYPE_U32,
+    IR_TYPE_U64,
+
     NUM_IR_TYPES
 } IRType;
 
@@ -21,7 +26,6 @@ struct IRAllocation {
     int id;
     IRAllocation* next;
     IRType type;
-    i64 _val;
 };
 
 typedef enum {
@@ -61,6 +65,8 @@ typedef enum {
     IR_VALUE_ALLOCATION,
 } IRValueKind;
 
+// Each block owns a list of its instructions: start->prev and end->next are
+// null, and an empty block has neither.
 typedef struct IRBasicBlock IRBasicBlock;
 struct IRBasicBlock {
     int id;
@@ -139,11 +145,13 @@ struct IRInstr {
     };
 };
 
+typedef struct IRAnalysis IRAnalysis;
+
 typedef struct {
-    IRInstr* first_instr;
     IRBasicBlock* first_block;
     IRAllocation* first_allocation;
     IRReg next_reg;
+    IRAnalysis* analysis;
 } IR;
 
 typedef struct {
@@ -152,16 +160,29 @@ typedef struct {
 } BBList;
 
 BBList bb_get_succ(IRBasicBlock* block);
-
-void bb_update_end(IRBasicBlock* block);
+bool bb_is_terminated(IRBasicBlock* block);
 
 void print_ir(IR* ir);
 
-void remove_ir_instr(IR* ir, IRInstr* instr);
-void insert_ir_instr_before(IR* ir, IRInstr* after, IRInstr* instr);
-void insert_ir_instr_at_block_start(IR* ir, IRBasicBlock* b, IRInstr* instr);
+void remove_ir_instr(IRInstr* instr);
+void insert_ir_instr_before(IRInstr* after, IRInstr* instr);
+void insert_ir_instr_after(IRInstr* before, IRInstr* instr);
+void insert_ir_instr_at_block_start(IRBasicBlock* b, IRInstr* instr);
+void append_ir_instr(IRBasicBlock* b, IRInstr* instr);
+
+// Writes the CFG as a Graphviz digraph. The counts are optional: by block id,
+// and by block id * 2 + successor index for edges.
+void output_cfg_graphviz(IR* ir, char* path, u64* block_counts, u64* edge_counts);
+
+int ir_block_count(IR* ir);
+int ir_allocation_count(IR* ir);
+int ir_instr_count(IR* ir);
+
+IRType ir_instr_type(IRInstr* instr);
+bool ir_type_is_signed(IRType type);
 
-void output_cfg_graphviz(IR* ir, char* path);
+IRReg* ir_instr_dest(IRInstr* instr);
+int ir_instr_operands(IRInstr* instr, IRValue** operands);
 
 IRInstr* new_ir_instr(Arena* arena, IROpCode op);
 
@@ -170,3 +191,4 @@ IRValue ir_reg_value(IRReg reg);
 IRValue ir_allocation_value(IRAllocation* allocation);
 
 #define FOREACH_IR_BB(name, head) for (IRBasicBlock* name = (head); name; name = name->next)
+#define FOREACH_IR_INSTR(name, b) for (IRInstr* name = (b)->start; name; name = name->next)
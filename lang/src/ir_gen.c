@@ -1,40 +1,33 @@
 #include <stdio.h>
 
 #include "ir_gen.h"
+#include "analysis.h"
 
-typedef struct {
+struct IRGen {
     Arena* arena;
-    IRInstr* cur_instr;
+    ASTPool* pool;
     IRBasicBlock* cur_block;
-    IRBasicBlock* first_block_to_be_placed;
     IRAllocation* cur_allocation;
     IRReg next_reg;
     int next_block_id;
     int next_allocation_id;
-} G;
+    IRBasicBlock block_head;
+    IRAllocation allocation_head;
+};
+
+typedef struct IRGen G;
 
 internal IRBasicBlock* new_ir_basic_block(Arena* arena) {
     return arena_push_type(arena, IRBasicBlock);
 }
 
 internal void emit(G* g, IRInstr* instr) {
-    g->cur_instr = g->cur_instr->next = instr;
-
-    FOREACH_IR_BB(b, g->first_block_to_be_placed)
-        b->start = instr;
-
-    g->cur_block->len++;
-    g->first_block_to_be_placed = 0;
-
-    instr->block = g->cur_block;
+    append_ir_instr(g->cur_block, instr);
 }
 
 internal void place_block(G* g, IRBasicBlock* block) {
     block->id = g->next_block_id++;
     g->cur_block = g->cur_block->next = block;
-
-    if (!g->first_block_to_be_placed)
-        g->first_block_to_be_placed = block;
 }
 
 internal IRReg new_reg(G* g) {
@@ -44,22 +37,147 @@ internal IRReg new_reg(G* g) {
 IRType get_first_class_type(Type* type) {
     assert(type);
     assert(type->flags & TYPE_IS_FIRST_CLASS);
+    bool is_signed = (type->flags & TYPE_IS_SIGNED) != 0;
     switch (type->size) {
         default:
             assert(false);
             return IR_TYPE_ILLEGAL;
         case 1:
-            return IR_TYPE_I8;
+            return is_signed ? IR_TYPE_I8 : IR_TYPE_U8;
         case 2:
-            return IR_TYPE_I16;
+            return is_signed ? IR_TYPE_I16 : IR_TYPE_U16;
         case 4:
-            return IR_TYPE_I32;
+            return is_signed ? IR_TYPE_I32 : IR_TYPE_U32;
         case 8:
-            return IR_TYPE_I64;
+            return is_signed ? IR_TYPE_I64 : IR_TYPE_U64;
+    }
+}
+
+internal AST* node(G* g, ASTRef ref) {
+    return ast_node(g->pool, ref);
+}
+
+IRBasicBlock* ir_gen_new_block(IRGen* g) {
+    return new_ir_basic_block(g->arena);
+}
+
+void ir_gen_place_block(IRGen* g, IRBasicBlock* block) {
+    place_block(g, block);
+}
+
+IRAllocation* ir_gen_allocation(IRGen* g, Type* type) {
+    IRAllocation* allocation = arena_push_type(g->arena, IRAllocation);
+    allocation->id = g->next_allocation_id++;
+    allocation->type = get_first_class_type(type);
+    g->cur_allocation = g->cur_allocation->next = allocation;
+    return allocation;
+}
+
+IRValue ir_gen_load(IRGen* g, Type* type, IRAllocation* allocation) {
+    IRInstr* instr = new_ir_instr(g->arena, IR_OP_LOAD);
+    instr->load.type = get_first_class_type(type);
+    instr->load.loc = ir_allocation_value(allocation);
+    instr->load.dest = new_reg(g);
+    emit(g, instr);
+    return ir_reg_value(instr->load.dest);
+}
+
+void ir_gen_store(IRGen* g, Type* type, IRAllocation* allocation, IRValue src) {
+    IRInstr* instr = new_ir_instr(g->arena, IR_OP_STORE);
+    instr->store.type = get_first_class_type(type);
+    instr->store.src = src;
+    instr->store.loc = ir_allocation_value(allocation);
+    emit(g, instr);
+}
+
+IRValue ir_gen_cast(IRGen* g, Type* from, Type* to, IRValue src) {
+    IROpCode op = 0;
+
+    if (from->size > to->size) {
+        op = IR_OP_TRUNC;
+    }
+    else if (from->size == to->size) {
+        return src;
+    }
+    // Widening keeps the value, so the source decides how to extend.
+    else if (from->flags & TYPE_IS_SIGNED) {
+        op = IR_OP_SEXT;
+    }
+    else {
+        op = IR_OP_ZEXT;
+    }
+
+    IRInstr* instr = new_ir_instr(g->arena, op);
+    instr->cast.type_src = get_first_class_type(from);
+    instr->cast.type_dest = get_first_class_type(to);
+    instr->cast.src = src;
+    instr->cast.dest = new_reg(g);
+    emit(g, instr);
+
+    return ir_reg_value(instr->cast.dest);
+}
+
+IRValue ir_gen_binary(IRGen* g, IROpCode op, Type* type, IRValue l, IRValue r) {
+    IRInstr* instr = new_ir_instr(g->arena, op);
+    instr->bin.type = get_first_class_type(type);
+    instr->bin.l = l;
+    instr->bin.r = r;
+    instr->bin.dest = new_reg(g);
+    emit(g, instr);
+    return ir_reg_value(instr->bin.dest);
+}
+
+void ir_gen_return(IRGen* g, Type* type, IRValue val) {
+    IRInstr* instr = new_ir_instr(g->arena, IR_OP_RET);
+    instr->ret.type = get_first_class_type(type);
+    instr->ret.val = val;
+    emit(g, instr);
+
+    place_block(g, new_ir_basic_block(g->arena));
+}
+
+void ir_gen_branch(IRGen* g, Type* type, IRValue cond, IRBasicBlock* then, IRBasicBlock* els) {
+    IRInstr* br = new_ir_instr(g->arena, IR_OP_BRANCH);
+    br->branch.type = get_first_class_type(type);
+    br->branch.cond = cond;
+    br->branch.then_loc = then;
+    br->branch.els_loc  = els;
+    emit(g, br);
+}
+
+void ir_gen_jump(IRGen* g, IRBasicBlock* to) {
+    IRInstr* jmp = new_ir_instr(g->arena, IR_OP_JMP);
+    jmp->jmp_loc = to;
+    emit(g, jmp);
+}
+
+IROpCode ir_gen_binary_op(ASTKind kind) {
+    switch (kind) {
+        default:
+            assert(false);
+            return IR_OP_ILLEGAL;
+        case AST_ADD:
+            return IR_OP_ADD;
+        case AST_SUB:
+            return IR_OP_SUB;
+        case AST_MUL:
+            return IR_OP_MUL;
+        case AST_DIV:
+            return IR_OP_DIV;
+        case AST_LESS:
+            return IR_OP_LESS;
+        case AST_LEQUAL:
+            return IR_OP_LEQUAL;
+        case AST_NEQUAL:
+            return IR_OP_NEQUAL;
+        case AST_EQUAL:
+            return IR_OP_EQUAL;
     }
 }
 
-internal IRValue gen(G* g, AST* ast) {
+internal IRValue gen(G* g, ASTRef ref) {
+    AST* ast = node(g, ref);
+
     static_assert(NUM_AST_KINDS == 18, "not all ast kinds handled");
     switch (ast->kind) {
         default:
@@ -67,45 +185,14 @@ internal IRValue gen(G* g, AST* ast) {
             return (IRValue){0};
 
         case AST_INT:
-            return ir_integer_value(ast->int_val);
-
-        case AST_VAR: {
-            IRInstr* instr = new_ir_instr(g->arena, IR_OP_LOAD);
-            instr->load.type = get_first_class_type(ast->type);
-            instr->load.loc = ir_allocation_value(ast->var.sym->allocation);
-            instr->load.dest = new_reg(g);
-            emit(g, instr);
-            return ir_reg_value(instr->load.dest);
-        }
-
-        case AST_CAST: {
-            Type* a = ast->cast.expr->type;
-            Type* b = ast->type;
-
-            IRValue src = gen(g, ast->cast.expr);
-            IROpCode op = 0;
-
-            if (a->size > b->size) {
-                op = IR_OP_TRUNC;
-            }
-            else if (a->size == b->size) {
-                return src;
-            }
-            else if (b->flags & TYPE_IS_SIGNED) {
-                op = IR_OP_SEXT;
-            }
-            else {
-                op = IR_OP_ZEXT;
-            }
+            return ir_integer_value(((ASTInt*)ast)->val);
 
-            IRInstr* instr = new_ir_instr(g->arena, op);
-            instr->cast.type_src = get_first_class_type(a);
-            instr->cast.type_dest = get_first_class_type(b);
-            instr->cast.src = src;
-            instr->cast.dest = new_reg(g);
-            emit(g, instr);
+        case AST_VAR:
+            return ir_gen_load(g, ast->type, ((ASTVar*)ast)->sym->allocation);
 
-            return ir_reg_value(instr->cast.dest);
+        case AST_CAST: {
+            ASTRef expr = ((ASTCast*)ast)->expr;
+            return ir_gen_cast(g, node(g, expr)->type, ast->type, gen(g, expr));
         }
 
         case AST_ADD:
@@ -117,118 +204,68 @@ internal IRValue gen(G* g, AST* ast) {
         case AST_NEQUAL:
         case AST_EQUAL:
         {
-            IROpCode op = IR_OP_ILLEGAL;
-            switch (ast->kind) {
-                case AST_ADD:
-                    op = IR_OP_ADD;
-                    break;
-                case AST_SUB:
-                    op = IR_OP_SUB;
-                    break;
-                case AST_MUL:
-                    op = IR_OP_MUL;
-                    break;
-                case AST_DIV:
-                    op = IR_OP_DIV;
-                    break;
-                case AST_LESS:
-                    op = IR_OP_LESS;
-                    break;
-                case AST_LEQUAL:
-                    op = IR_OP_LEQUAL;
-                    break;
-                case AST_NEQUAL:
-                    op = IR_OP_NEQUAL;
-                    break;
-                case AST_EQUAL:
-                    op = IR_OP_EQUAL;
-                    break;
-            }
-
-            IRInstr* instr = new_ir_instr(g->arena, op);
-            instr->bin.type = get_first_class_type(ast->type);
-            instr->bin.l = gen(g, ast->bin.l);
-            instr->bin.r = gen(g, ast->bin.r);
-            instr->bin.dest = new_reg(g);
-            emit(g, instr);
-
-            return ir_reg_value(instr->bin.dest);
+            ASTBin* bin = (ASTBin*)ast;
+            IRValue l = gen(g, bin->l);
+            IRValue r = gen(g, bin->r);
+            return ir_gen_binary(g, ir_gen_binary_op(ast->kind), ast->type, l, r);
         }
 
         case AST_ASSIGN: {
-            assert(ast->bin.l->kind == AST_VAR);
+            ASTBin* bin = (ASTBin*)ast;
+            ASTVar* var = (ASTVar*)node(g, bin->l);
+            assert(var->base.kind == AST_VAR);
 
-            IRValue result = gen(g, ast->bin.r);
-
-            IRInstr* instr = new_ir_instr(g->arena, IR_OP_STORE);
-            instr->store.type = get_first_class_type(ast->type);
-            instr->store.src = result;
-            instr->store.loc = ir_allocation_value(ast->bin.l->var.sym->allocation);
-            emit(g, instr);
+            IRValue result = gen(g, bin->r);
+            ir_gen_store(g, ast->type, var->sym->allocation, result);
 
             return result;
         }
 
-        case AST_BLOCK:
-            for (AST* c = ast->block.first_stmt; c; c = c->next)
-                gen(g, c);
+        case AST_BLOCK: {
+            ASTBlock* block = (ASTBlock*)ast;
+            for (u32 i = 0; i < block->count; ++i)
+                gen(g, block->stmts[i]);
             return (IRValue) { 0 };
+        }
 
         case AST_RETURN: {
-            IRInstr* instr = new_ir_instr(g->arena, IR_OP_RET);
-            instr->ret.type = get_first_class_type(ast->return_val->type);
-            instr->ret.val = gen(g, ast->return_val);
-            emit(g, instr);
-
-            place_block(g, new_ir_basic_block(g->arena));
-
+            ASTRef val = ((ASTReturn*)ast)->val;
+            ir_gen_return(g, node(g, val)->type, gen(g, val));
             return (IRValue) { 0 };
         }
 
         case AST_VAR_DECL: {
-            IRAllocation* allocation = arena_push_type(g->arena, IRAllocation);
-            ast->var_decl.sym->allocation = allocation;
-
-            g->cur_allocation = g->cur_allocation->next = allocation;
+            ASTVarDecl* decl = (ASTVarDecl*)ast;
 
-            IRInstr* instr = new_ir_instr(g->arena, IR_OP_STORE);
-            instr->store.type = get_first_class_type(ast->var_decl.init->type);
-            instr->store.src = gen(g, ast->var_decl.init);
-            instr->store.loc = ir_allocation_value(allocation);
-            emit(g, instr);
-
-            allocation->id = g->next_allocation_id++;
-            allocation->type = instr->store.type;
+            // The initializer was checked against the declared type, so the
+            // allocation can be typed before it is generated.
+            decl->sym->allocation = ir_gen_allocation(g, node(g, decl->init)->type);
+            ir_gen_store(g, node(g, decl->init)->type, decl->sym->allocation, gen(g, decl->init));
 
             return (IRValue) { 0 };
         }
 
         case AST_IF: {
+            ASTConditional* c = (ASTConditional*)ast;
+
             IRBasicBlock* then = new_ir_basic_block(g->arena);
             IRBasicBlock* els  = new_ir_basic_block(g->arena);
             IRBasicBlock* end  = 0;
 
-            IRInstr* br = new_ir_instr(g->arena, IR_OP_BRANCH);
-            br->branch.type = get_first_class_type(ast->conditional.cond->type);
-            br->branch.cond = gen(g, ast->conditional.cond);
-            br->branch.then_loc = then;
-            br->branch.els_loc  = els;
-            emit(g, br);
+            ir_gen_branch(g, node(g, c->cond)->type, gen(g, c->cond), then, els);
 
             place_block(g, then);
-            gen(g, ast->conditional.then);
+            gen(g, c->then);
 
-            if (ast->conditional.els) {
+            if (c->els) {
                 end = new_ir_basic_block(g->arena);
-                IRInstr* jmp = new_ir_instr(g->arena, IR_OP_JMP);
-                jmp->jmp_loc = end;
-                emit(g, jmp);
+                ir_gen_jump(g, end);
             }
 
             place_block(g, els);
 
-            if (ast->conditional.els) {
-                gen(g, ast->conditional.els);
+            if (c->els) {
+                gen(g, c->els);
                 place_block(g, end);
             }
 
@@ -236,24 +273,18 @@ internal IRValue gen(G* g, AST* ast) {
         }
 
         case AST_WHILE: {
+            ASTConditional* c = (ASTConditional*)ast;
+
             IRBasicBlock* start = new_ir_basic_block(g->arena);
             IRBasicBlock* body  = new_ir_basic_block(g->arena);
             IRBasicBlock* end   = new_ir_basic_block(g->arena);
 
             place_block(g, start);
-            IRInstr* br = new_ir_instr(g->arena, IR_OP_BRANCH);
-            br->branch.type = get_first_class_type(ast->conditional.cond->type);
-            br->branch.cond = gen(g, ast->conditional.cond);
-            br->branch.then_loc = body;
-            br->branch.els_loc  = end;
-            emit(g, br);
+            ir_gen_branch(g, node(g, c->cond)->type, gen(g, c->cond), body, end);
 
             place_block(g, body);
-            gen(g, ast->conditional.then);
-
-            IRInstr* jmp = new_ir_instr(g->arena, IR_OP_JMP);
-            jmp->jmp_loc = start;
-            emit(g, jmp);
+            gen(g, c->then);
+            ir_gen_jump(g, start);
 
             place_block(g, end);
 
@@ -262,35 +293,29 @@ internal IRValue gen(G* g, AST* ast) {
     }
 }
 
-IR ir_gen(Arena* arena, AST* ast) {
-    IRInstr instr_head = { 0 };
-    IRBasicBlock block_head = { 0 };
-    IRAllocation allocation_head = { 0 };
-
-    G g = {
-        .arena = arena,
-        .cur_instr = &instr_head,
-        .cur_block = &block_head,
-        .cur_allocation = &allocation_head,
-        .next_reg = 1
-    };
+IRGen* ir_gen_begin(Arena* arena, ASTPool* pool) {
+    G* g = arena_push_type(arena, G);
+    g->arena = arena;
+    g->pool = pool;
+    g->cur_block = &g->block_head;
+    g->cur_allocation = &g->allocation_head;
+    g->next_reg = 1;
 
-    place_block(&g, new_ir_basic_block(g.arena));
-    gen(&g, ast);
-
-    IRInstr* prev = 0;
-    for (IRInstr* instr = instr_head.next; instr; instr = instr->next) {
-        instr->prev = prev;
-        prev = instr;
-    }
-
-    FOREACH_IR_BB(b, block_head.next)
-        bb_update_end(b);
+    place_block(g, new_ir_basic_block(g->arena));
+    return g;
+}
 
+IR ir_gen_end(IRGen* g) {
     return (IR) {
-        .first_instr = instr_head.next,
-        .first_block = block_head.next,
-        .first_allocation = allocation_head.next,
-        .next_reg = g.next_reg,
+        .first_block = g->block_head.next,
+        .first_allocation = g->allocation_head.next,
+        .next_reg = g->next_reg,
+        .analysis = new_ir_analysis(g->arena),
     };
 }
+
+IR ir_gen(Arena* arena, ASTPool* pool) {
+    IRGen* g = ir_gen_begin(arena, pool);
+    gen(g, pool->root);
+    return ir_gen_end(g);
+}
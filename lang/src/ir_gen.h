@@ -3,4 +3,28 @@
 #include "ast.h"
 #include "ir.h"
 
-IR ir_gen(Arena* arena, AST* ast);
+IR ir_gen(Arena* arena, ASTPool* pool);
+
+// Generator state shared by ir_gen() and the fused front end, which emits
+// through the functions below while it parses.
+typedef struct IRGen IRGen;
+
+IRGen* ir_gen_begin(Arena* arena, ASTPool* pool);
+IR ir_gen_end(IRGen* g);
+
+IROpCode ir_gen_binary_op(ASTKind kind);
+
+IRBasicBlock* ir_gen_new_block(IRGen* g);
+void ir_gen_place_block(IRGen* g, IRBasicBlock* block);
+
+IRAllocation* ir_gen_allocation(IRGen* g, Type* type);
+IRValue ir_gen_load(IRGen* g, Type* type, IRAllocation* allocation);
+void ir_gen_store(IRGen* g, Type* type, IRAllocation* allocation, IRValue src);
+IRValue ir_gen_cast(IRGen* g, Type* from, Type* to, IRValue src);
+IRValue ir_gen_binary(IRGen* g, IROpCode op, Type* type, IRValue l, IRValue r);
+
+// Ends the current block with a return and starts a new one for whatever
+// follows it.
+void ir_gen_return(IRGen* g, Type* type, IRValue val);
+void ir_gen_branch(IRGen* g, Type* type, IRValue cond, IRBasicBlock* then, IRBasicBlock* els);
+void ir_gen_jump(IRGen* g, IRBasicBlock* to);
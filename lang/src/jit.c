@@ -0,0 +1,701 @@
+#include "jit.h"
+#include "regalloc.h"
+#include "core.h"
+
+#if JIT_SUPPORTED
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+enum {
+    RAX = 0,
+    RCX = 1,
+    RDX = 2,
+    RBX = 3,
+    RBP = 5,
+    RSI = 6,
+    RDI = 7,
+    R8 = 8,
+    R9 = 9,
+    R10 = 10,
+    R11 = 11,
+    R12 = 12,
+    R13 = 13,
+    R14 = 14,
+    R15 = 15,
+};
+
+// rax, rcx and rdx are kept free as scratch registers; rbp holds the frame.
+static const u8 allocatable_regs[] = { RBX, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+internal bool is_callee_saved(int reg) {
+    switch (reg) {
+        default:
+            return false;
+        case RBX:
+        case R12:
+        case R13:
+        case R14:
+        case R15:
+            return true;
+#ifdef _WIN32
+        case RSI:
+        case RDI:
+            return true;
+#endif
+    }
+}
+
+typedef struct {
+    int offset;
+    int target;
+} JITFixup;
+
+typedef struct {
+    IR* ir;
+
+    u8* code;
+    int len;
+    int cap;
+
+    int fixup_count;
+    JITFixup* fixups;
+
+    RegAlloc* ra;
+    u32 alloc_base;
+    u32 result_slot;
+} J;
+
+internal void emit_u8(J* j, u8 b) {
+    assert(j->len < j->cap);
+    j->code[j->len++] = b;
+}
+
+internal void emit_u32(J* j, u32 v) {
+    for (int i = 0; i < 4; ++i)
+        emit_u8(j, (u8)(v >> (i * 8)));
+}
+
+internal void emit_u64(J* j, u64 v) {
+    for (int i = 0; i < 8; ++i)
+        emit_u8(j, (u8)(v >> (i * 8)));
+}
+
+internal int type_bits(IRType type) {
+    static_assert(NUM_IR_TYPES == 9, "not all ir types handled");
+    switch (type) {
+        default:
+            assert(false);
+            return 0;
+        case IR_TYPE_I8:
+        case IR_TYPE_U8:
+            return 8;
+        case IR_TYPE_I16:
+        case IR_TYPE_U16:
+            return 16;
+        case IR_TYPE_I32:
+        case IR_TYPE_U32:
+            return 32;
+        case IR_TYPE_I64:
+        case IR_TYPE_U64:
+            return 64;
+    }
+}
+
+internal void emit_rex_w(J* j, int reg, int rm) {
+    emit_u8(j, (u8)(0x48 | ((reg >> 3) << 2) | (rm >> 3)));
+}
+
+// mov reg, [rbp + slot*8] / mov [rbp + slot*8], reg
+internal void emit_slot_access(J* j, u8 opcode, int reg, u32 slot) {
+    emit_rex_w(j, reg, 0);
+    emit_u8(j, opcode);
+    emit_u8(j, (u8)(0x80 | ((reg & 7) << 3) | RBP));
+    emit_u32(j, slot * 8);
+}
+
+// mov dest, src
+internal void emit_mov_reg(J* j, int dest, int src) {
+    emit_rex_w(j, src, dest);
+    emit_u8(j, 0x89);
+    emit_u8(j, (u8)(0xC0 | ((src & 7) << 3) | (dest & 7)));
+}
+
+internal void emit_push(J* j, int reg) {
+    if (reg >= 8)
+        emit_u8(j, 0x41);
+    emit_u8(j, (u8)(0x50 + (reg & 7)));
+}
+
+internal void emit_pop(J* j, int reg) {
+    if (reg >= 8)
+        emit_u8(j, 0x41);
+    emit_u8(j, (u8)(0x58 + (reg & 7)));
+}
+
+internal void emit_load_slot(J* j, int reg, u32 slot) {
+    emit_slot_access(j, 0x8B, reg, slot);
+}
+
+internal void emit_store_slot(J* j, u32 slot, int reg) {
+    emit_slot_access(j, 0x89, reg, slot);
+}
+
+// A RA_LOC_TEMP location is rcx.
+internal void emit_load_loc(J* j, int reg, RALoc loc) {
+    switch (loc.kind) {
+        default:
+            assert(false);
+            break;
+        case RA_LOC_REG:
+            emit_mov_reg(j, reg, allocatable_regs[loc.index]);
+            break;
+        case RA_LOC_SLOT:
+            emit_load_slot(j, reg, loc.index);
+            break;
+        case RA_LOC_TEMP:
+            emit_mov_reg(j, reg, RCX);
+            break;
+    }
+}
+
+internal void emit_store_loc(J* j, RALoc loc, int reg) {
+    switch (loc.kind) {
+        default:
+            assert(false);
+            break;
+        case RA_LOC_REG:
+            emit_mov_reg(j, allocatable_regs[loc.index], reg);
+            break;
+        case RA_LOC_SLOT:
+            emit_store_slot(j, loc.index, reg);
+            break;
+        case RA_LOC_TEMP:
+            emit_mov_reg(j, RCX, reg);
+            break;
+    }
+}
+
+internal void emit_store_dest(J* j, IRReg dest, int reg) {
+    assert(dest < j->ir->next_reg);
+    emit_store_loc(j, j->ra->locs[dest], reg);
+}
+
+internal void emit_load_value(J* j, int reg, IRValue value) {
+    switch (value.kind) {
+        default:
+            assert(false);
+            break;
+
+        case IR_VALUE_REG:
+            assert(value.reg < j->ir->next_reg);
+            emit_load_loc(j, reg, j->ra->locs[value.reg]);
+            break;
+
+        case IR_VALUE_INTEGER: {
+            i64 imm = (i64)value.integer;
+            if (imm >= INT32_MIN && imm <= INT32_MAX) {
+                // mov r64, simm32
+                emit_rex_w(j, 0, reg);
+                emit_u8(j, 0xC7);
+                emit_u8(j, (u8)(0xC0 | (reg & 7)));
+                emit_u32(j, (u32)imm);
+            }
+            else {
+                // mov r64, imm64
+                emit_rex_w(j, 0, reg);
+                emit_u8(j, (u8)(0xB8 + (reg & 7)));
+                emit_u64(j, value.integer);
+            }
+        } break;
+    }
+}
+
+internal u32 allocation_slot(J* j, IRValue loc) {
+    assert(loc.kind == IR_VALUE_ALLOCATION);
+    return j->alloc_base + loc.allocation->id;
+}
+
+// Two-operand ALU instruction "op al/ax/eax/rax, cl/cx/ecx/rcx" at the given width.
+internal void emit_alu_rax_rcx(J* j, u8 opcode8, u8 opcode, int bits) {
+    switch (bits) {
+        case 8:
+            emit_u8(j, opcode8);
+            break;
+        case 16:
+            emit_u8(j, 0x66);
+            emit_u8(j, opcode);
+            break;
+        case 32:
+            emit_u8(j, opcode);
+            break;
+        case 64:
+            emit_u8(j, 0x48);
+            emit_u8(j, opcode);
+            break;
+    }
+    emit_u8(j, 0xC8);
+}
+
+internal void emit_test_rax(J* j, int bits) {
+    switch (bits) {
+        case 8:
+            emit_u8(j, 0x84);
+            break;
+        case 16:
+            emit_u8(j, 0x66);
+            emit_u8(j, 0x85);
+            break;
+        case 32:
+            emit_u8(j, 0x85);
+            break;
+        case 64:
+            emit_u8(j, 0x48);
+            emit_u8(j, 0x85);
+            break;
+    }
+    emit_u8(j, 0xC0);
+}
+
+// Sign-extend al/ax/eax into rax
+internal void emit_sext_rax(J* j, int bits) {
+    switch (bits) {
+        case 8:
+            emit_u8(j, 0x48); emit_u8(j, 0x0F); emit_u8(j, 0xBE); emit_u8(j, 0xC0);
+            break;
+        case 16:
+            emit_u8(j, 0x48); emit_u8(j, 0x0F); emit_u8(j, 0xBF); emit_u8(j, 0xC0);
+            break;
+        case 32:
+            emit_u8(j, 0x48); emit_u8(j, 0x63); emit_u8(j, 0xC0);
+            break;
+    }
+}
+
+// Zero-extend al/ax/eax into rax
+internal void emit_zext_rax(J* j, int bits) {
+    switch (bits) {
+        case 8:
+            emit_u8(j, 0x0F); emit_u8(j, 0xB6); emit_u8(j, 0xC0);
+            break;
+        case 16:
+            emit_u8(j, 0x0F); emit_u8(j, 0xB7); emit_u8(j, 0xC0);
+            break;
+        case 32:
+            emit_u8(j, 0x89); emit_u8(j, 0xC0);
+            break;
+    }
+}
+
+internal void emit_jump(J* j, u8 cc, int target_block) {
+    if (cc) {
+        emit_u8(j, 0x0F);
+        emit_u8(j, cc);
+    }
+    else {
+        emit_u8(j, 0xE9);
+    }
+
+    j->fixups[j->fixup_count++] = (JITFixup) {
+        .offset = j->len,
+        .target = target_block,
+    };
+
+    emit_u32(j, 0);
+}
+
+internal void emit_epilogue(J* j) {
+    for (int i = (int)LEN(allocatable_regs) - 1; i >= 0; --i) {
+        if ((j->ra->used_regs >> i) & 1 && is_callee_saved(allocatable_regs[i]))
+            emit_pop(j, allocatable_regs[i]);
+    }
+
+    emit_pop(j, RBP);
+    emit_u8(j, 0xC3); // ret
+}
+
+// Phi moves of an edge. Memory-to-memory moves go through rax.
+internal void emit_edge_moves(J* j, RAMoveList* moves) {
+    for (int i = 0; i < moves->count; ++i)
+    {
+        RAMove* m = &moves->moves[i];
+
+        if (m->dest.kind == RA_LOC_SLOT && m->src.kind == RA_LOC_SLOT) {
+            emit_load_loc(j, RAX, m->src);
+            emit_store_loc(j, m->dest, RAX);
+        }
+        else if (m->src.kind == RA_LOC_SLOT) {
+            int dest = m->dest.kind == RA_LOC_TEMP ? RCX : allocatable_regs[m->dest.index];
+            emit_load_loc(j, dest, m->src);
+        }
+        else {
+            int src = m->src.kind == RA_LOC_TEMP ? RCX : allocatable_regs[m->src.index];
+            emit_store_loc(j, m->dest, src);
+        }
+    }
+}
+
+internal void emit_edge(J* j, IRBasicBlock* from, int succ_index, IRBasicBlock* to, u8 cc) {
+    RAMoveList* moves = ra_edge_moves(j->ra, from, succ_index);
+
+    if (moves->count > 0) {
+        emit_edge_moves(j, moves);
+        emit_jump(j, 0, to->id);
+    }
+    else {
+        emit_jump(j, cc, to->id);
+    }
+}
+
+internal void emit_instr(J* j, IRInstr* instr) {
+    static_assert(NUM_IR_OPS == 19, "not all ir ops handled");
+    switch (instr->op) {
+        default:
+            assert(false);
+            break;
+
+        case IR_OP_PHI:
+            // Resolved by the moves on the incoming edges.
+            break;
+
+        case IR_OP_COPY:
+            emit_load_value(j, RAX, instr->copy.src);
+            emit_store_dest(j, instr->copy.dest, RAX);
+            break;
+
+        case IR_OP_LOAD:
+            emit_load_slot(j, RAX, allocation_slot(j, instr->load.loc));
+            emit_store_dest(j, instr->load.dest, RAX);
+            break;
+
+        case IR_OP_STORE:
+            emit_load_value(j, RAX, instr->store.src);
+            emit_store_slot(j, allocation_slot(j, instr->store.loc), RAX);
+            break;
+
+        case IR_OP_SEXT:
+            emit_load_value(j, RAX, instr->cast.src);
+            emit_sext_rax(j, type_bits(instr->cast.type_src));
+            emit_store_dest(j, instr->cast.dest, RAX);
+            break;
+
+        case IR_OP_ZEXT:
+            emit_load_value(j, RAX, instr->cast.src);
+            emit_zext_rax(j, type_bits(instr->cast.type_src));
+            emit_store_dest(j, instr->cast.dest, RAX);
+            break;
+
+        case IR_OP_TRUNC:
+            emit_load_value(j, RAX, instr->cast.src);
+            emit_store_dest(j, instr->cast.dest, RAX);
+            break;
+
+        case IR_OP_ADD:
+        case IR_OP_SUB:
+        case IR_OP_MUL:
+        case IR_OP_DIV:
+        case IR_OP_LESS:
+        case IR_OP_LEQUAL:
+        case IR_OP_NEQUAL:
+        case IR_OP_EQUAL:
+        {
+            int bits = type_bits(instr->bin.type);
+            bool is_signed = ir_type_is_signed(instr->bin.type);
+
+            emit_load_value(j, RAX, instr->bin.l);
+            emit_load_value(j, RCX, instr->bin.r);
+
+            switch (instr->op) {
+                case IR_OP_ADD:
+                    emit_alu_rax_rcx(j, 0x00, 0x01, bits);
+                    break;
+
+                case IR_OP_SUB:
+                    emit_alu_rax_rcx(j, 0x28, 0x29, bits);
+                    break;
+
+                case IR_OP_MUL:
+                    // imul eax/rax, ecx/rcx; there is no two-operand 8-bit form,
+                    // but the low bits of a 32-bit multiply are the same.
+                    if (bits == 64)
+                        emit_u8(j, 0x48);
+                    emit_u8(j, 0x0F);
+                    emit_u8(j, 0xAF);
+                    emit_u8(j, 0xC1);
+                    break;
+
+                case IR_OP_DIV:
+                    if (!is_signed) {
+                        if (bits == 8) {
+                            emit_zext_rax(j, 8); // movzx eax, al
+                        }
+                        else {
+                            emit_u8(j, 0x31); emit_u8(j, 0xD2); // xor edx, edx
+                        }
+
+                        if (bits == 16)
+                            emit_u8(j, 0x66);
+                        if (bits == 64)
+                            emit_u8(j, 0x48);
+                        emit_u8(j, bits == 8 ? 0xF6 : 0xF7); emit_u8(j, 0xF1); // div cl/cx/ecx/rcx
+                        break;
+                    }
+
+                    // idiv traps when the quotient overflows, so 8/16-bit operands
+                    // are divided at 32 bits and a divisor of -1 negates instead,
+                    // which wraps MIN / -1 to MIN like the VM.
+                    if (bits < 32) {
+                        u8 movsx = bits == 8 ? 0xBE : 0xBF;
+                        emit_u8(j, 0x0F); emit_u8(j, movsx); emit_u8(j, 0xC0); // movsx eax, al/ax
+                        emit_u8(j, 0x0F); emit_u8(j, movsx); emit_u8(j, 0xC9); // movsx ecx, cl/cx
+                    }
+
+                    u8 rex = bits == 64 ? 0x48 : 0;
+                    u8 rex_len = rex ? 1 : 0;
+                    if (rex)
+                        emit_u8(j, rex);
+                    emit_u8(j, 0x83); emit_u8(j, 0xF9); emit_u8(j, 0xFF); // cmp ecx/rcx, -1
+                    emit_u8(j, 0x75); emit_u8(j, 4 + rex_len); // jne over neg and jmp
+                    if (rex)
+                        emit_u8(j, rex);
+                    emit_u8(j, 0xF7); emit_u8(j, 0xD8); // neg eax/rax
+                    emit_u8(j, 0xEB); emit_u8(j, 3 + 2 * rex_len); // jmp over cdq and idiv
+                    if (rex)
+                        emit_u8(j, rex);
+                    emit_u8(j, 0x99); // cdq/cqo
+                    if (rex)
+                        emit_u8(j, rex);
+                    emit_u8(j, 0xF7); emit_u8(j, 0xF9); // idiv ecx/rcx
+                    break;
+
+                case IR_OP_LESS:
+                case IR_OP_LEQUAL:
+                case IR_OP_NEQUAL:
+                case IR_OP_EQUAL:
+                {
+                    u8 setcc = 0;
+                    switch (instr->op) {
+                        case IR_OP_LESS:
+                            setcc = is_signed ? 0x9C : 0x92; // setl / setb
+                            break;
+                        case IR_OP_LEQUAL:
+                            setcc = is_signed ? 0x9E : 0x96; // setle / setbe
+                            break;
+                        case IR_OP_NEQUAL:
+                            setcc = 0x95;
+                            break;
+                        case IR_OP_EQUAL:
+                            setcc = 0x94;
+                            break;
+                    }
+
+                    emit_alu_rax_rcx(j, 0x38, 0x39, bits); // cmp
+                    emit_u8(j, 0x0F); emit_u8(j, setcc); emit_u8(j, 0xC0); // setcc al
+                    emit_zext_rax(j, 8);
+                } break;
+            }
+
+            emit_store_dest(j, instr->bin.dest, RAX);
+        } break;
+
+        case IR_OP_RET:
+            emit_load_value(j, RAX, instr->ret.val);
+            if (ir_type_is_signed(instr->ret.type))
+                emit_sext_rax(j, type_bits(instr->ret.type));
+            else
+                emit_zext_rax(j, type_bits(instr->ret.type));
+            emit_load_slot(j, RCX, j->result_slot);
+            emit_u8(j, 0x48); emit_u8(j, 0x89); emit_u8(j, 0x01); // mov [rcx], rax
+            emit_u8(j, 0xB8); emit_u32(j, 1); // mov eax, 1
+            emit_epilogue(j);
+            break;
+
+        case IR_OP_JMP:
+            emit_edge(j, instr->block, 0, instr->jmp_loc, 0);
+            break;
+
+        case IR_OP_BRANCH: {
+            IRBasicBlock* then_loc = instr->branch.then_loc;
+            IRBasicBlock* els_loc = instr->branch.els_loc;
+
+            emit_load_value(j, RAX, instr->branch.cond);
+            emit_test_rax(j, type_bits(instr->branch.type));
+
+            if (ra_edge_moves(j->ra, instr->block, 0)->count > 0) {
+                // jz over the then-edge moves
+                emit_u8(j, 0x0F); emit_u8(j, 0x84);
+                int skip = j->len;
+                emit_u32(j, 0);
+
+                emit_edge(j, instr->block, 0, then_loc, 0);
+
+                u32 rel = (u32)(j->len - (skip + 4));
+                memcpy(j->code + skip, &rel, sizeof(rel));
+            }
+            else {
+                emit_jump(j, 0x85, then_loc->id); // jnz
+            }
+
+            emit_edge(j, instr->block, 1, els_loc, 0);
+        } break;
+    }
+}
+
+internal void* alloc_exec(size_t size) {
+#ifdef _WIN32
+    return VirtualAlloc(0, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+    void* ptr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return ptr == MAP_FAILED ? 0 : ptr;
+#endif
+}
+
+internal bool protect_exec(void* ptr, size_t size) {
+#ifdef _WIN32
+    DWORD old;
+    return VirtualProtect(ptr, size, PAGE_EXECUTE_READ, &old);
+#else
+    return mprotect(ptr, size, PROT_READ | PROT_EXEC) == 0;
+#endif
+}
+
+bool jit_compile(IR* ir, JITProgram* prog) {
+    Scratch scratch = get_scratch(0, 0);
+
+    int nblock = ir_block_count(ir);
+    int nalloc = ir_allocation_count(ir);
+
+    int ninstr = 0;
+    int nphi_param = 0;
+    FOREACH_IR_BB(b, ir->first_block) {
+        FOREACH_IR_INSTR(instr, b) {
+            ++ninstr;
+            if (instr->op == IR_OP_PHI)
+                nphi_param += instr->phi.param_count;
+        }
+    }
+
+    RegAlloc ra = reg_alloc(scratch.arena, ir, (int)LEN(allocatable_regs));
+
+    J j = {
+        .ir = ir,
+        .cap = 64 + ninstr * 64 + nphi_param * 32 + nblock * 48,
+        .fixups = arena_push_array(scratch.arena, JITFixup, ninstr * 2 + nblock + 1),
+        .ra = &ra,
+        .alloc_base = ra.slot_count,
+        .result_slot = ra.slot_count + nalloc,
+    };
+
+    j.code = arena_push(scratch.arena, j.cap);
+
+    int* block_offset = arena_push_array(scratch.arena, int, nblock);
+
+    emit_push(&j, RBP);
+    for (int i = 0; i < (int)LEN(allocatable_regs); ++i) {
+        if ((ra.used_regs >> i) & 1 && is_callee_saved(allocatable_regs[i]))
+            emit_push(&j, allocatable_regs[i]);
+    }
+
+    // mov rbp, frame; mov [rbp + result_slot], result
+#ifdef _WIN32
+    emit_mov_reg(&j, RBP, RCX);
+    emit_store_slot(&j, j.result_slot, RDX);
+#else
+    emit_mov_reg(&j, RBP, RDI);
+    emit_store_slot(&j, j.result_slot, RSI);
+#endif
+
+    FOREACH_IR_BB(b, ir->first_block)
+    {
+        block_offset[b->id] = j.len;
+
+        IRInstr* instr = b->start;
+        for (int i = 0; i < b->len; ++i) {
+            emit_instr(&j, instr);
+            instr = instr->next;
+        }
+
+        // Fall-through edges with phi moves run them before entering the next block.
+        if (!bb_is_terminated(b)) {
+            BBList succ = bb_get_succ(b);
+            if (succ.count > 0 && ra_edge_moves(&ra, b, 0)->count > 0)
+                emit_edge(&j, b, 0, succ.data[0], 0);
+        }
+    }
+
+    // Falling off the end: xor eax, eax
+    emit_u8(&j, 0x31); emit_u8(&j, 0xC0);
+    emit_epilogue(&j);
+
+    for (int i = 0; i < j.fixup_count; ++i) {
+        JITFixup* f = &j.fixups[i];
+        u32 rel = (u32)(block_offset[f->target] - (f->offset + 4));
+        memcpy(j.code + f->offset, &rel, sizeof(rel));
+    }
+
+    *prog = (JITProgram) {
+        .code_size = j.len,
+        .frame_size = j.result_slot + 1,
+    };
+
+    prog->code = alloc_exec(prog->code_size);
+    if (!prog->code) {
+        release_scratch(&scratch);
+        return false;
+    }
+
+    memcpy(prog->code, j.code, j.len);
+
+    if (!protect_exec(prog->code, prog->code_size)) {
+        jit_free(prog);
+        release_scratch(&scratch);
+        return false;
+    }
+
+    memcpy(&prog->func, &prog->code, sizeof(prog->func));
+
+    release_scratch(&scratch);
+    return true;
+}
+
+bool jit_run(JITProgram* prog, i64* result) {
+    Scratch scratch = get_scratch(0, 0);
+    i64* frame = arena_push_array(scratch.arena, i64, prog->frame_size);
+    bool returned = prog->func(frame, result);
+    release_scratch(&scratch);
+    return returned;
+}
+
+void jit_free(JITProgram* prog) {
+    if (prog->code) {
+#ifdef _WIN32
+        VirtualFree(prog->code, 0, MEM_RELEASE);
+#else
+        munmap(prog->code, prog->code_size);
+#endif
+    }
+    *prog = (JITProgram) { 0 };
+}
+
+#else
+
+bool jit_compile(IR* ir, JITProgram* prog) {
+    (void)ir;
+    *prog = (JITProgram) { 0 };
+    return false;
+}
+
+bool jit_run(JITProgram* prog, i64* result) {
+    (void)prog;
+    (void)result;
+    return false;
+}
+
+void jit_free(JITProgram* prog) {
+    *prog = (JITProgram) { 0 };
+}
+
+#endif
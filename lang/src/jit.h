@@ -0,0 +1,24 @@
+#pragma once
+
+#include "ir.h"
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define JIT_SUPPORTED 1
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+// Compiled code is called with a frame of frame_size i64 slots and a result
+// pointer. It returns true if the program executed a ret.
+typedef bool (*JITFunc)(i64* frame, i64* result);
+
+typedef struct {
+    void* code;
+    size_t code_size;
+    u32 frame_size;
+    JITFunc func;
+} JITProgram;
+
+bool jit_compile(IR* ir, JITProgram* prog);
+bool jit_run(JITProgram* prog, i64* result);
+void jit_free(JITProgram* prog);
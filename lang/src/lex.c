@@ -1,135 +1,503 @@
-#include <ctype.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
 
 #include "lex.h"
+#include "core.h"
 
-Lexer lex_init(char* src) {
-    return (Lexer) {
-        .ptr = src,
-        .line = 1,
-    };
+#if defined(_M_X64) || defined(__SSE2__)
+#define LEX_SSE2 1
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#else
+#define LEX_SSE2 0
+#endif
+
+enum {
+    CHAR_SPACE = BIT(0),
+    CHAR_DIGIT = BIT(1),
+    CHAR_IDENT = BIT(2),
+};
+
+#define S CHAR_SPACE
+#define D (CHAR_DIGIT | CHAR_IDENT)
+#define I CHAR_IDENT
+
+// Replaces the locale-aware <ctype.h> calls. Bytes outside ASCII have no class.
+internal const u8 char_class[256] = {
+    [' '] = S, ['\t'] = S, ['\r'] = S, ['\n'] = S, ['\v'] = S, ['\f'] = S, ['0'] = D, ['1'] = D,
+    ['2'] = D, ['3'] = D, ['4'] = D, ['5'] = D, ['6'] = D, ['7'] = D, ['8'] = D, ['9'] = D,
+    ['A'] = I, ['B'] = I, ['C'] = I, ['D'] = I, ['E'] = I, ['F'] = I, ['G'] = I, ['H'] = I,
+    ['I'] = I, ['J'] = I, ['K'] = I, ['L'] = I, ['M'] = I, ['N'] = I, ['O'] = I, ['P'] = I,
+    ['Q'] = I, ['R'] = I, ['S'] = I, ['T'] = I, ['U'] = I, ['V'] = I, ['W'] = I, ['X'] = I,
+    ['Y'] = I, ['Z'] = I, ['a'] = I, ['b'] = I, ['c'] = I, ['d'] = I, ['e'] = I, ['f'] = I,
+    ['g'] = I, ['h'] = I, ['i'] = I, ['j'] = I, ['k'] = I, ['l'] = I, ['m'] = I, ['n'] = I,
+    ['o'] = I, ['p'] = I, ['q'] = I, ['r'] = I, ['s'] = I, ['t'] = I, ['u'] = I, ['v'] = I,
+    ['w'] = I, ['x'] = I, ['y'] = I, ['z'] = I, ['_'] = I,
+};
+
+#undef S
+#undef D
+#undef I
+
+internal bool is_class(char c, u8 class) {
+    return (char_class[(u8)c] & class) != 0;
+}
+
+#if LEX_SSE2
+
+// The scanners below load the aligned 16 byte chunk containing the cursor. An
+// aligned load never crosses a page, so they can't fault past the terminator.
+
+internal int lowest_bit(u32 mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int)index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+internal __m128i in_range(__m128i c, char lo, char hi) {
+    return _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8(lo - 1)), _mm_cmplt_epi8(c, _mm_set1_epi8(hi + 1)));
+}
+
+internal u32 ident_mask(__m128i c) {
+    __m128i m = _mm_or_si128(in_range(c, 'a', 'z'), in_range(c, 'A', 'Z'));
+    m = _mm_or_si128(m, in_range(c, '0', '9'));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(c, _mm_set1_epi8('_')));
+    return (u32)_mm_movemask_epi8(m);
+}
+
+internal u32 digit_mask(__m128i c) {
+    return (u32)_mm_movemask_epi8(in_range(c, '0', '9'));
 }
 
-internal bool is_ident(char c) {
-    return isalnum(c) || c == '_';
+internal u32 space_mask(__m128i c) {
+    __m128i m = _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8(' ')), in_range(c, '\t', '\r'));
+    return (u32)_mm_movemask_epi8(m);
 }
 
-internal int check_kw(char* start, Lexer* l, char* kw, int kind) {
-    size_t len = l->ptr - start;
+internal u32 line_end_mask(__m128i c) {
+    __m128i m = _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(c, _mm_setzero_si128()));
+    return (u32)_mm_movemask_epi8(m);
+}
 
-    if (len == strlen(kw) && memcmp(start, kw, len) == 0)
-        return kind;
+internal __m128i load_chunk(char* chunk) {
+    return _mm_load_si128((__m128i*)chunk);
+}
+
+// Bytes of p's chunk that are at or after p.
+internal u32 first_chunk_mask(char* p) {
+    return (0xffffu << ((uintptr_t)p & 15)) & 0xffff;
+}
 
-    return TOK_IDENT;
+internal char* first_chunk(char* p) {
+    return p - ((uintptr_t)p & 15);
 }
 
-internal int ident_kind(char* start, Lexer* l) {
-    switch (start[0]) {
-        case 'r':
-            return check_kw(start, l, "return", TOK_RETURN);
-        case 'i':
-            return check_kw(start, l, "if", TOK_IF);
-        case 'e':
-            return check_kw(start, l, "else", TOK_ELSE);
-        case 'w':
-            return check_kw(start, l, "while", TOK_WHILE);
+internal char* scan_ident_wide(char* p) {
+    u32 valid = first_chunk_mask(p);
+    for (char* chunk = first_chunk(p);; chunk += 16, valid = 0xffff) {
+        u32 stop = ~ident_mask(load_chunk(chunk)) & valid;
+        if (stop)
+            return chunk + lowest_bit(stop);
     }
+}
 
-    return TOK_IDENT;
+internal char* scan_digits_wide(char* p) {
+    u32 valid = first_chunk_mask(p);
+    for (char* chunk = first_chunk(p);; chunk += 16, valid = 0xffff) {
+        u32 stop = ~digit_mask(load_chunk(chunk)) & valid;
+        if (stop)
+            return chunk + lowest_bit(stop);
+    }
 }
 
-internal void eat_whitespace(Lexer* l) {
-    while (isspace(*l->ptr)) {
-        if (*l->ptr == '\n')
-            ++l->line;
-        ++l->ptr;
+internal char* scan_line_end_wide(char* p) {
+    u32 valid = first_chunk_mask(p);
+    for (char* chunk = first_chunk(p);; chunk += 16, valid = 0xffff) {
+        u32 stop = line_end_mask(load_chunk(chunk)) & valid;
+        if (stop)
+            return chunk + lowest_bit(stop);
     }
 }
 
-internal bool match(Lexer* l, char c) {
-    if (*l->ptr == c) {
-        ++l->ptr;
-        return true;
+internal char* scan_space_wide(char* p) {
+    u32 valid = first_chunk_mask(p);
+    for (char* chunk = first_chunk(p);; chunk += 16, valid = 0xffff) {
+        u32 stop = ~space_mask(load_chunk(chunk)) & valid;
+        if (stop)
+            return chunk + lowest_bit(stop);
     }
-    return false;
 }
 
-Token lex(Lexer* l) {
-    if (l->next.ptr) {
-        Token tok = l->next;
-        l->next.ptr = 0;
-        return tok;
+#endif
+
+// Most runs are a few bytes long, so the scanners start with a few scalar steps
+// and only switch to 16 bytes at a time once a run turns out to be longer.
+#define LEX_SCALAR_STEPS 8
+
+internal char* scan_ident(char* p) {
+    for (int i = 0; i < LEX_SCALAR_STEPS; ++i, ++p) {
+        if (!is_class(*p, CHAR_IDENT))
+            return p;
+    }
+#if LEX_SSE2
+    return scan_ident_wide(p);
+#else
+    while (is_class(*p, CHAR_IDENT))
+        ++p;
+    return p;
+#endif
+}
+
+internal char* scan_digits(char* p) {
+    for (int i = 0; i < LEX_SCALAR_STEPS; ++i, ++p) {
+        if (!is_class(*p, CHAR_DIGIT))
+            return p;
+    }
+#if LEX_SSE2
+    return scan_digits_wide(p);
+#else
+    while (is_class(*p, CHAR_DIGIT))
+        ++p;
+    return p;
+#endif
+}
+
+internal char* scan_line_end(char* p) {
+    for (int i = 0; i < LEX_SCALAR_STEPS; ++i, ++p) {
+        if (*p == '\n' || *p == '\0')
+            return p;
+    }
+#if LEX_SSE2
+    return scan_line_end_wide(p);
+#else
+    while (*p != '\n' && *p != '\0')
+        ++p;
+    return p;
+#endif
+}
+
+internal char* scan_space(char* p) {
+    for (int i = 0; i < LEX_SCALAR_STEPS; ++i, ++p) {
+        if (!is_class(*p, CHAR_SPACE))
+            return p;
+    }
+#if LEX_SSE2
+    return scan_space_wide(p);
+#else
+    while (is_class(*p, CHAR_SPACE))
+        ++p;
+    return p;
+#endif
+}
+
+typedef struct {
+    char* text;
+    u32 len;
+    u16 kind;
+    Atom atom;
+} KeywordEntry;
+
+// Perfect hash over the keywords and built-in type names, keyed by the first
+// and last character and the length. Entries are placed by the same hash at
+// compile time, so a new word that collides overrides another initializer.
+#define KEYWORD_HASH(first, last, len) ((u32)((first) * 2 + (last) + (len) * 3) & 15)
+#define KEYWORD(text, first, last, kind, atom) \
+    [KEYWORD_HASH(first, last, sizeof(text) - 1)] = { text, sizeof(text) - 1, kind, atom }
+
+internal const KeywordEntry keyword_table[16] = {
+    KEYWORD("return", 'r', 'n', TOK_RETURN, ATOM_NONE),
+    KEYWORD("if",     'i', 'f', TOK_IF,     ATOM_NONE),
+    KEYWORD("else",   'e', 'e', TOK_ELSE,   ATOM_NONE),
+    KEYWORD("while",  'w', 'e', TOK_WHILE,  ATOM_NONE),
+
+    KEYWORD("u8",  'u', '8', TOK_IDENT, ATOM_U8),
+    KEYWORD("u16", 'u', '6', TOK_IDENT, ATOM_U16),
+    KEYWORD("u32", 'u', '2', TOK_IDENT, ATOM_U32),
+    KEYWORD("u64", 'u', '4', TOK_IDENT, ATOM_U64),
+
+    KEYWORD("i8",  'i', '8', TOK_IDENT, ATOM_I8),
+    KEYWORD("i16", 'i', '6', TOK_IDENT, ATOM_I16),
+    KEYWORD("i32", 'i', '2', TOK_IDENT, ATOM_I32),
+    KEYWORD("i64", 'i', '4', TOK_IDENT, ATOM_I64),
+};
+
+#undef KEYWORD
+
+internal const KeywordEntry* find_keyword(char* start, u32 len) {
+    if (len < 2 || len > 6)
+        return 0;
+
+    const KeywordEntry* entry = &keyword_table[KEYWORD_HASH(start[0], start[len - 1], len)];
+    if (entry->len == len && memcmp(start, entry->text, len) == 0)
+        return entry;
+
+    return 0;
+}
+
+// Lives in scratch memory for the duration of tokenize(). The table maps an
+// identifier to its atom; names and hashes are indexed by atom.
+typedef struct {
+    Arena* arena;
+    u32 count;
+    String* names;
+    u32* hashes;
+    u32 table_size;
+    Atom* table;
+} Interner;
+
+internal void interner_grow(Interner* in) {
+    u32 table_size = in->table_size ? in->table_size * 2 : 1024;
+    u32 cap = table_size / 2;
+
+    String* names = arena_push_array(in->arena, String, cap);
+    u32* hashes = arena_push_array(in->arena, u32, cap);
+    if (in->count) {
+        memcpy(names, in->names, in->count * sizeof(String));
+        memcpy(hashes, in->hashes, in->count * sizeof(u32));
+    }
+
+    Atom* table = arena_push_array(in->arena, Atom, table_size);
+    for (Atom atom = NUM_BUILTIN_ATOMS; atom < in->count; ++atom) {
+        u32 i = hashes[atom] & (table_size - 1);
+        while (table[i])
+            i = (i + 1) & (table_size - 1);
+        table[i] = atom;
+    }
+
+    in->names = names;
+    in->hashes = hashes;
+    in->table_size = table_size;
+    in->table = table;
+}
+
+internal Interner interner_init(Arena* arena) {
+    Interner in = { .arena = arena };
+    interner_grow(&in);
+
+    for (int i = 0; i < (int)LEN(keyword_table); ++i) {
+        const KeywordEntry* entry = &keyword_table[i];
+        if (entry->atom)
+            in.names[entry->atom] = (String) { .len = (int)entry->len, .ptr = entry->text };
+    }
+
+    in.count = NUM_BUILTIN_ATOMS;
+    return in;
+}
+
+internal Atom intern(Interner* in, char* start, u32 len) {
+    if ((in->count + 1) * 2 > in->table_size)
+        interner_grow(in);
+
+    u32 hash = (u32)fnv_1_a_hash(start, (int)len);
+    u32 mask = in->table_size - 1;
+
+    for (u32 i = hash & mask;; i = (i + 1) & mask) {
+        Atom atom = in->table[i];
+
+        if (!atom) {
+            atom = in->count++;
+            in->names[atom] = (String) { .len = (int)len, .ptr = start };
+            in->hashes[atom] = hash;
+            in->table[i] = atom;
+            return atom;
+        }
+
+        if (in->hashes[atom] == hash && in->names[atom].len == (int)len && memcmp(in->names[atom].ptr, start, len) == 0)
+            return atom;
     }
+}
 
-    eat_whitespace(l);
+internal bool match(char** p, char c) {
+    if (**p == c) {
+        ++*p;
+        return true;
+    }
+    return false;
+}
 
-    while (l->ptr[0] == '/' && l->ptr[1] == '/') {
-        while (*l->ptr != '\n' && *l->ptr != '\0')
-            ++l->ptr;
+internal LexToken lex(Interner* in, char* src, char** cursor) {
+    char* p = scan_space(*cursor);
 
-        eat_whitespace(l);
+    while (p[0] == '/' && p[1] == '/') {
+        p = scan_line_end(p + 2);
+        p = scan_space(p);
     }
 
-    char* start = l->ptr++;
+    char* start = p++;
     int kind = *start;
-    int line = l->line;
+    Atom atom = ATOM_NONE;
 
     switch (kind) {
         default:
-            if (isdigit(*start)) {
-                while (isdigit(*l->ptr))
-                    ++l->ptr;
+            if (is_class(*start, CHAR_DIGIT)) {
+                p = scan_digits(p);
                 kind = TOK_INT;
             }
-            else if (is_ident(*start)) {
-                while (is_ident(*l->ptr))
-                    ++l->ptr;
-                kind = ident_kind(start, l);
+            else if (is_class(*start, CHAR_IDENT)) {
+                p = scan_ident(p);
+
+                u32 len = (u32)(p - start);
+                const KeywordEntry* keyword = find_keyword(start, len);
+
+                if (keyword) {
+                    kind = keyword->kind;
+                    atom = keyword->atom;
+                }
+                else {
+                    kind = TOK_IDENT;
+                    atom = intern(in, start, len);
+                }
             }
             break;
         case '\0':
-            --l->ptr;
+            --p;
             break;
         case '<':
-            if (match(l, '='))
+            if (match(&p, '='))
                 kind = TOK_LEQUAL;
             break;
         case '>':
-            if (match(l, '='))
+            if (match(&p, '='))
                 kind = TOK_GEQUAL;
             break;
         case '!':
-            if (match(l, '='))
+            if (match(&p, '='))
                 kind = TOK_NEQUAL;
             break;
         case '=':
-            if (match(l, '='))
+            if (match(&p, '='))
                 kind = TOK_EEQUAL;
             break;
     }
 
-    return (Token) {
-        .kind = kind,
-        .len = (int)(l->ptr-start),
-        .ptr = start,
-        .line = line
+    *cursor = p;
+
+    return (LexToken) {
+        .offset = (u32)(start - src),
+        .len = (u32)(p - start),
+        .atom = atom,
+        .kind = (u16)kind,
     };
 }
 
-Token lex_peek(Lexer* l) {
-    if (!l->next.ptr) {
-        l->next = lex(l);
+TokenList tokenize(Arena* arena, char* src) {
+    size_t src_len = strlen(src);
+    assert(src_len < UINT32_MAX);
+
+    Scratch scratch = get_scratch(&arena, 1);
+    Interner in = interner_init(scratch.arena);
+
+    TokenList list = { 0 };
+
+    // Tokens are collected in scratch, doubling from a guess of one token per
+    // four bytes, and copied out once the count is known.
+    u32 cap = (u32)(src_len / 4) + 64;
+    LexToken* tokens = arena_push(scratch.arena, cap * sizeof(LexToken));
+
+    char* cursor = src;
+    for (;;) {
+        if (list.count == cap) {
+            LexToken* grown = arena_push(scratch.arena, cap * 2 * sizeof(LexToken));
+            memcpy(grown, tokens, cap * sizeof(LexToken));
+            tokens = grown;
+            cap *= 2;
+        }
+
+        LexToken tok = lex(&in, src, &cursor);
+        tokens[list.count++] = tok;
+        if (tok.kind == TOK_EOF)
+            break;
+    }
+
+    list.tokens = arena_push(arena, list.count * sizeof(LexToken));
+    memcpy(list.tokens, tokens, list.count * sizeof(LexToken));
+
+    list.line_count = 1;
+    for (char* nl = src; (nl = memchr(nl, '\n', src + src_len - nl)); ++nl)
+        ++list.line_count;
+
+    list.line_start = arena_push(arena, list.line_count * sizeof(u32));
+    list.line_start[0] = 0;
+
+    u32 line = 1;
+    for (char* nl = src; (nl = memchr(nl, '\n', src + src_len - nl)); ++nl)
+        list.line_start[line++] = (u32)(nl + 1 - src);
+
+    list.atom_count = in.count;
+    list.atom_names = arena_push_array(arena, String, in.count);
+    memcpy(list.atom_names, in.names, in.count * sizeof(String));
+
+    release_scratch(&scratch);
+    return list;
+}
+
+int token_line(TokenList* list, u32 offset) {
+    u32 lo = 0;
+    u32 hi = list->line_count;
+
+    // Find the last line starting at or before offset.
+    while (hi - lo > 1) {
+        u32 mid = lo + (hi - lo) / 2;
+        if (list->line_start[mid] <= offset)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    return (int)lo + 1;
+}
+
+internal thread_local DiagnosticBuffer* diagnostic_buffer;
+
+void set_diagnostic_buffer(DiagnosticBuffer* buffer) {
+    diagnostic_buffer = buffer;
+}
+
+internal int diagnostic_vprintf(char* fmt, va_list ap) {
+    DiagnosticBuffer* d = diagnostic_buffer;
+    if (!d)
+        return vprintf(fmt, ap);
+
+    va_list count_ap;
+    va_copy(count_ap, ap);
+    int n = vsnprintf(0, 0, fmt, count_ap);
+    va_end(count_ap);
+
+    if (n < 0)
+        return 0;
+
+    size_t needed = d->len + (size_t)n + 1;
+    if (needed > d->cap) {
+        size_t cap = d->cap ? d->cap * 2 : 256;
+        while (cap < needed)
+            cap *= 2;
+
+        char* text = arena_push(d->arena, cap);
+        if (d->len)
+            memcpy(text, d->text, d->len);
+
+        d->text = text;
+        d->cap = cap;
     }
 
-    return l->next;
+    vsnprintf(d->text + d->len, (size_t)n + 1, fmt, ap);
+    d->len += n;
+    return n;
 }
 
-void  lex_jump(Lexer* l, Token tok) {
-    l->next.ptr = 0;
-    l->ptr = tok.ptr;
-    l->line = tok.line;
+internal int diagnostic_printf(char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = diagnostic_vprintf(fmt, ap);
+    va_end(ap);
+    return n;
 }
 
 void error_tok(char* src, Token tok, char* fmt, ...) {
@@ -137,23 +505,23 @@ void error_tok(char* src, Token tok, char* fmt, ...) {
     while (l != src && *l != '\n')
         --l;
 
-    while (isspace(*l))
+    while (is_class(*l, CHAR_SPACE))
         ++l;
 
     int nl = 0;
     while (l[nl] != '\0' && l[nl] != '\n')
         ++nl;
 
-    int offset = printf("Line %d: Error: ", tok.line);
-    printf("%.*s\n", nl, l);
+    int offset = diagnostic_printf("Line %d: Error: ", tok.line);
+    diagnostic_printf("%.*s\n", nl, l);
 
-    printf("%*s^ ", offset + (int)(tok.ptr - l), "");
+    diagnostic_printf("%*s^ ", offset + (int)(tok.ptr - l), "");
 
     va_list ap;
     va_start(ap, fmt);
-    vprintf(fmt, ap);
+    diagnostic_vprintf(fmt, ap);
     va_end(ap);
 
-    printf("\n");
+    diagnostic_printf("\n");
 }
 
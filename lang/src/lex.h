@@ -19,22 +19,65 @@ enum {
     TOK_WHILE,
 };
 
+// Every distinct identifier is interned to an atom while lexing, so later
+// stages compare names as integers. The built-in type names have fixed atoms.
+typedef u32 Atom;
+
+enum {
+    ATOM_NONE,
+
+    ATOM_U8,
+    ATOM_U16,
+    ATOM_U32,
+    ATOM_U64,
+
+    ATOM_I8,
+    ATOM_I16,
+    ATOM_I32,
+    ATOM_I64,
+
+    NUM_BUILTIN_ATOMS,
+};
+
 typedef struct {
     int kind;
     int len;
     char* ptr;
     int line;
+    Atom atom;
 } Token;
 
 typedef struct {
-    char* ptr;
-    int line;
-    Token next;
-} Lexer;
+    u32 offset;
+    u32 len;
+    Atom atom;
+    u16 kind;
+} LexToken;
+
+// The whole source lexed up front. The last token is TOK_EOF. Line n starts
+// at byte line_start[n - 1], and atom_names[atom] is the text of each atom.
+typedef struct {
+    u32 count;
+    LexToken* tokens;
+    u32 line_count;
+    u32* line_start;
+    u32 atom_count;
+    String* atom_names;
+} TokenList;
 
-Lexer lex_init(char* src);
-Token lex(Lexer* l);
-Token lex_peek(Lexer* l);
-void  lex_jump(Lexer* l, Token tok);
+TokenList tokenize(Arena* arena, char* src);
+int token_line(TokenList* list, u32 offset);
 
 void error_tok(char* src, Token tok, char* fmt, ...);
+
+// Diagnostics are printed unless the calling thread has a buffer set, in which
+// case they are appended to `text` (NUL-terminated), growing it in `arena`.
+// Lets a worker keep the diagnostics of each file it compiles together.
+typedef struct {
+    Arena* arena;
+    char* text;
+    size_t len;
+    size_t cap;
+} DiagnosticBuffer;
+
+void set_diagnostic_buffer(DiagnosticBuffer* buffer);
@@ -1,86 +1,142 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "base.h"
+#include "batch.h"
+#include "bench.h"
 #include "ir_gen.h"
+#include "jit.h"
 #include "parse.h"
 #include "core.h"
 #include "opt.h"
+#include "profile.h"
 #include "sem.h"
+#include "stream.h"
+#include "vm.h"
 
-#define ARENA_CAP (5 * 1024 * 1024)
+// Compiles a generated program and reports how long each phase takes.
+static int run_bench(CompileContext* ctx, int statements, bool stream) {
+    Arena* arena = &ctx->arena;
 
-static Arena scratch_arenas[3];
+    char* src = generate_bench_source(arena, statements, 0x9e3779b9);
 
-Scratch get_scratch(Arena** conflicts, int conflict_count) {
-    for (int i = 0; i < LEN(scratch_arenas); ++i)
-    {
-        bool does_conflict = false;
+    double t0 = time_seconds();
+    double t1 = t0, t2 = t0, t3 = t0;
 
-        for (int j = 0; j < conflict_count; ++j)
-        {
-            if (&scratch_arenas[i] == conflicts[j]) {
-                does_conflict = true;
-                break;
-            }
-        }
-    
-        if (!does_conflict) {
-            return (Scratch) {
-                .arena = scratch_arenas + i,
-                .used = scratch_arenas[i].used
-            };
-        }
+    ASTPool* ast = 0;
+    Program prog = program_init(arena);
+    IR ir;
+
+    if (stream) {
+        if (!compile_stream(arena, src, &prog, &ir)) return 1;
+        t3 = time_seconds();
     }
+    else {
+        ast = parse(arena, src);
+        if (!ast) return 1;
 
-    assert(false && "all scratch arenas conflict!");
-    return (Scratch) { 0 };
-}
+        t1 = time_seconds();
 
-void release_scratch(Scratch* scratch) {
-    assert(scratch->arena->used >= scratch->used);
-    scratch->arena->used = scratch->used;
-}
+        if (!sem_ast(arena, &prog, ast)) return 1;
 
-internal i64 value_val(i64* regs, IRValue value) {
-    switch (value.kind) {
-        default:
-            assert(false);
-            return 0;
+        t2 = time_seconds();
 
-        case IR_VALUE_REG:
-            return regs[value.reg];
+        ir = ir_gen(arena, ast);
 
-        case IR_VALUE_INTEGER:
-            return value.integer;
+        t3 = time_seconds();
     }
-}
 
-internal i64* value_addr(IRValue value) {
-    switch (value.kind) {
-        default:
-            assert(false);
-            return 0;
+    int pre_blocks = ir_block_count(&ir);
+    int pre_instrs = ir_instr_count(&ir);
+    IRReg pre_regs = ir.next_reg;
+
+    OptTimings timings = { 0 };
+    optimize(arena, &ir, &timings);
+
+    double t4 = time_seconds();
 
-        case IR_VALUE_ALLOCATION:
-            return &value.allocation->_val;
+    printf("Source:   %zu bytes, %d statements\n", strlen(src), statements);
+    if (ast)
+        printf("AST:      %u nodes, %zu bytes, %u tokens\n", ast->node_count, ast->node_bytes, ast->tokens.count);
+    printf("IR:       %d blocks, %d -> %d instructions, %u -> %u registers\n", pre_blocks, pre_instrs, ir_instr_count(&ir), pre_regs, ir.next_reg);
+    if (stream) {
+        printf("Stream:   %8.3f ms\n", (t3 - t0) * 1000.0);
     }
+    else {
+        printf("Parse:    %8.3f ms\n", (t1 - t0) * 1000.0);
+        printf("Sem:      %8.3f ms\n", (t2 - t1) * 1000.0);
+        printf("IR gen:   %8.3f ms\n", (t3 - t2) * 1000.0);
+    }
+    printf("Optimize: %8.3f ms\n", (t4 - t3) * 1000.0);
+    for (int i = 0; i < timings.count; ++i)
+        printf("  %-8s %8.3f ms\n", timings.names[i], timings.seconds[i] * 1000.0);
+    printf("Total:    %8.3f ms\n", (t4 - t0) * 1000.0);
+    printf("Arena:    %zu bytes peak, %zu committed\n", arena->peak, arena->committed);
+    for (int i = 0; i < SCRATCH_ARENA_COUNT; ++i)
+        printf("Scratch%d: %zu bytes peak, %zu committed\n", i, ctx->scratch_arenas[i].peak, ctx->scratch_arenas[i].committed);
+    printf("CFG:      %zu bytes peak, %zu committed\n", ctx->cfg_arena.peak, ctx->cfg_arena.committed);
+    printf("Instrs:   %zu bytes peak, %zu committed\n", ctx->instrs_arena.peak, ctx->instrs_arena.committed);
+
+    return 0;
 }
 
-int main() {
-    Arena arena = {
-        .ptr = malloc(ARENA_CAP),
-        .cap = ARENA_CAP,
-    };
-
-    for (int i = 0; i < LEN(scratch_arenas); ++i) {
-        scratch_arenas[i] = (Arena){
-            .ptr = malloc(ARENA_CAP),
-            .cap = ARENA_CAP
-        };
+int main(int argc, char** argv) {
+    bool use_jit = false;
+    bool batch = false;
+    bool stream = false;
+    bool profile = false;
+    int bench_statements = 0;
+    int thread_count = 0;
+
+    char** paths = malloc(argc * sizeof(char*));
+    int path_count = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-jit") == 0) {
+            use_jit = true;
+        }
+        else if (strcmp(argv[i], "-bench") == 0 && i + 1 < argc) {
+            bench_statements = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-stream") == 0) {
+            stream = true;
+        }
+        else if (strcmp(argv[i], "-profile") == 0) {
+            profile = true;
+        }
+        else if (strcmp(argv[i], "-batch") == 0) {
+            batch = true;
+        }
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            thread_count = atoi(argv[++i]);
+        }
+        else if (argv[i][0] != '-') {
+            paths[path_count++] = argv[i];
+        }
+        else {
+            printf("Unknown option '%s'\n", argv[i]);
+            return 1;
+        }
+    }
+
+    CompileContext ctx = compile_context_create();
+    bind_compile_context(&ctx);
+
+    if (bench_statements > 0)
+        return run_bench(&ctx, bench_statements, stream);
+
+    if (batch) {
+        if (profile) {
+            printf("-profile can't be combined with -batch\n");
+            return 1;
+        }
+        return run_batch(paths, path_count, thread_count > 0 ? thread_count : default_thread_count(), use_jit, stream) ? 1 : 0;
     }
 
-    char* src_path = "examples/test.lang";
+    Arena* arena = &ctx.arena;
+
+    char* src_path = path_count > 0 ? paths[0] : "examples/test.lang";
     FILE* file;
     if (fopen_s(&file, src_path, "r")) {
         printf("Failed to load '%s'\n", src_path);
@@ -91,117 +147,64 @@ int main() {
     size_t file_len = ftell(file);
     rewind(file);
 
-    char* src = arena_push(&arena, file_len + 1);
+    char* src = arena_push(arena, file_len + 1);
     size_t src_len = fread(src, 1, file_len, file);
     src[src_len] = '\0';
 
-    AST* ast = parse(&arena, src);
-    if (!ast) return 1;
+    Program prog = program_init(arena);
+    IR ir;
 
-    Program prog = program_init(&arena);
+    if (stream) {
+        if (!compile_stream(arena, src, &prog, &ir)) return 1;
+    }
+    else {
+        ASTPool* ast = parse(arena, src);
+        if (!ast) return 1;
 
-    if (!sem_ast(&arena, src, &prog, ast)) return 1;
+        if (!sem_ast(arena, &prog, ast)) return 1;
 
-    IR ir = ir_gen(&arena, ast);
+        ir = ir_gen(arena, ast);
+    }
 
     printf("Pre-optimizaton:\n--------------------------\n");
     print_ir(&ir);
 
-    optimize(&arena, &ir);
+    optimize(arena, &ir, 0);
 
     printf("Post-optimizaton:\n-------------------------\n");
     print_ir(&ir);
 
-    i64 regs[512];
-
-    IRBasicBlock* cur_bb = ir.first_block;
-    IRBasicBlock* prev_bb = 0;
+    i64 result;
+    bool returned;
 
-    for (IRInstr* instr = ir.first_instr; instr;) {
-        if (instr->block != cur_bb) {
-            prev_bb = cur_bb;
-            cur_bb = instr->block;
+    // Profiling counts in the VM, so it takes precedence over -jit.
+    if (use_jit && !profile) {
+        JITProgram jit;
+        if (!jit_compile(&ir, &jit)) {
+            printf("Failed to JIT compile the program.\n");
+            return 1;
         }
 
-        static_assert(NUM_IR_OPS == 19, "not all ir ops handled");
-        switch (instr->op) {
-            default:
-                assert(false);
-                break;
-
-            case IR_OP_PHI: {
-                IRPhiParam* param = 0;
-                for (int i = 0; i < instr->phi.param_count; ++i) {
-                    if (instr->phi.params[i].block == prev_bb) {
-                        param = &instr->phi.params[i];
-                        break;
-                    }
-                }
-                assert(param);
-                if (param->reg != IR_EMPTY_REG)
-                    regs[instr->phi.dest] = regs[param->reg];
-            } break;
-
-            case IR_OP_COPY:
-                regs[instr->copy.dest] = value_val(regs, instr->copy.src);
-                break;
-
-            case IR_OP_LOAD:
-                regs[instr->load.dest] = *value_addr(instr->load.loc);
-                break;
-
-            case IR_OP_STORE:
-                *value_addr(instr->store.loc) = value_val(regs, instr->store.src);
-                break;
-
-            case IR_OP_SEXT:
-            case IR_OP_ZEXT:
-            case IR_OP_TRUNC:
-                regs[instr->cast.dest] = value_val(regs, instr->cast.src);
-                break;
-                
-            case IR_OP_ADD:
-                regs[instr->bin.dest] = value_val(regs, instr->bin.l) + value_val(regs, instr->bin.r);
-                break;
-            case IR_OP_SUB:
-                regs[instr->bin.dest] = value_val(regs, instr->bin.l) - value_val(regs, instr->bin.r);
-                break;
-            case IR_OP_MUL:
-                regs[instr->bin.dest] = value_val(regs, instr->bin.l) * value_val(regs, instr->bin.r);
-                break;
-            case IR_OP_DIV:
-                regs[instr->bin.dest] = value_val(regs, instr->bin.l) / value_val(regs, instr->bin.r);
-                break;
-            case IR_OP_LESS:
-                regs[instr->bin.dest] = value_val(regs, instr->bin.l) < value_val(regs, instr->bin.r);
-                break;
-            case IR_OP_LEQUAL:
-                regs[instr->bin.dest] = value_val(regs, instr->bin.l) <= value_val(regs, instr->bin.r);
-                break;
-            case IR_OP_NEQUAL:
-                regs[instr->bin.dest] = value_val(regs, instr->bin.l) != value_val(regs, instr->bin.r);
-                break;
-            case IR_OP_EQUAL:
-                regs[instr->bin.dest] = value_val(regs, instr->bin.l) == value_val(regs, instr->bin.r);
-                break;
-
-            case IR_OP_RET:
-                printf("Result: %lld\n", value_val(regs, instr->ret.val));
-                return 0;
-
-            case IR_OP_JMP:
-                instr = instr->jmp_loc->start;
-                continue;
-
-            case IR_OP_BRANCH: {
-                IRBasicBlock* b = value_val(regs, instr->branch.cond) ? instr->branch.then_loc : instr->branch.els_loc;
-                instr = b->start;
-            } continue;
+        returned = jit_run(&jit, &result);
+        jit_free(&jit);
+    }
+    else {
+        Bytecode bc = lower_ir(arena, &ir, profile);
+        returned = vm_run(&bc, &result);
+
+        if (profile) {
+            Profile p = collect_profile(&ir, &bc);
+            print_profile(&ir, &p);
+            output_cfg_graphviz(&ir, "profile.dot", p.block_counts, p.edge_counts);
+            printf("Wrote profile.dot\n");
         }
+    }
 
-        instr = instr->next;
+    if (!returned) {
+        printf("Program did not return.\n");
+        return 1;
     }
 
-    printf("Program did not return.\n");
-    return 1;
+    printf("Result: %lld\n", result);
+    return 0;
 }
\ No newline at end of file
@@ -1,235 +1,10 @@
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "opt.h"
+#include "analysis.h"
 #include "core.h"
 
-typedef struct {
-    bool* traversed;
-    int* indices;
-    IRBasicBlock** order;
-    int count;
-} PostOrder;
-
-internal IRBasicBlock* first_common_dominator(IRBasicBlock** idom, PostOrder* po, IRBasicBlock* b1, IRBasicBlock* b2) {
-    int f1 = po->indices[b1->id];
-    int f2 = po->indices[b2->id];
-
-    while (f1 != f2) {
-        while (f1 < f2)
-            f1 = po->indices[idom[po->order[f1]->id]->id];
-        while (f2 < f1)
-            f2 = po->indices[idom[po->order[f2]->id]->id];
-    }
-
-    return po->order[f1];
-}
-
-internal void get_post_order(PostOrder* po, IRBasicBlock* b) {
-    if (po->traversed[b->id])
-        return;
-    po->traversed[b->id] = true;
-
-    BBList succ = bb_get_succ( b);
-    for (int i = 0; i < succ.count; ++i)
-        get_post_order(po, succ.data[i]);
-
-    int index = po->count++;
-    po->order[index] = b;
-    po->indices[b->id] = index;
-}
-
-enum {
-    RBT_RED,
-    RBT_BLACK,
-};
-
-typedef struct BBSetNode BBSetNode;
-struct BBSetNode {
-    u8 color;
-    IRBasicBlock* b;
-    BBSetNode *p, *l, *r;
-};
-
-internal void bb_set_right_rotate(BBSetNode** root, BBSetNode* n) {
-    BBSetNode* left = n->l;
-
-    n->l = left->r;
-    if (n->l)
-        n->l->p = n;
-
-    left->p = n->p;
-    if (!n->p) {
-        *root = left;
-    }
-    else if (n == n->p->l) {
-        n->p->l = left;
-    }
-    else {
-        assert(n == n->p->r);
-        n->p->r = left;
-    }
-
-    left->r = n;
-    n->p = left;
-}
-
-internal void bb_set_left_rotate(BBSetNode** root, BBSetNode* n) {
-    BBSetNode* right = n->r;
-
-    n->r = right->l;
-    if (n->r)
-        n->r->p = n;
-
-    right->p = n->p;
-    if (!n->p) {
-        *root = right;
-    }
-    else if (n == n->p->l) {
-        n->p->l = right;
-    }
-    else {
-        assert(n == n->p->r);
-        n->p->r = right;
-    }
-
-    right->l = n;
-    n->p = right;
-}
-
-internal BBSetNode* bb_bst_insert(Arena* arena, BBSetNode** node, IRBasicBlock* b, BBSetNode* parent) {
-    if (!*node) {
-        BBSetNode* n = arena_push_type(arena, BBSetNode);
-        n->b = b;
-        n->p = parent;
-        *node = n;
-        return n;
-    }
-    else {
-        BBSetNode* n = *node;
-        if (b->id < n->b->id) {
-            return bb_bst_insert(arena, &n->l, b, n);
-        }
-        else if (b->id > n->b->id) {
-            return bb_bst_insert(arena, &n->r, b, n);
-        }
-        else {
-            assert(n->b == b);
-            return 0;
-        }
-    }
-}
-
-internal void bb_set_swap_colors(BBSetNode* a, BBSetNode* b) {
-    u8 temp = a->color;
-    a->color = b->color;
-    b->color = temp;
-}
-
-internal void bb_set_repair(BBSetNode** root, BBSetNode* x) {
-    if (x == *root) {
-        x->color = RBT_BLACK;
-    }
-    else if (x->p->color != RBT_BLACK) {
-        BBSetNode* p = x->p;
-        BBSetNode* g = p->p;
-        BBSetNode* u = p == g->l ? g->r : g->l;
-
-        u8 u_color = u ? u->color : RBT_BLACK;
-
-        if (u_color == RBT_RED) {
-            p->color = RBT_BLACK;
-            u->color = RBT_BLACK;
-            g->color = RBT_RED;
-            bb_set_repair(root, g);
-        }
-        else {
-            bool left_a = p == g->l;
-            bool left_b = x == p->l;
-
-            if (left_a && left_b) {
-                bb_set_right_rotate(root, g);
-                bb_set_swap_colors(p, g);
-            }
-            else if (!left_a && !left_b) {
-                bb_set_left_rotate(root, g);
-                bb_set_swap_colors(p, g);
-            }
-            else if (left_a && !left_b) {
-                bb_set_left_rotate(root, p);
-                bb_set_right_rotate(root, g);
-                bb_set_swap_colors(g, x);
-            }
-            else if (!left_a && left_b) {
-                bb_set_right_rotate(root, p);
-                bb_set_left_rotate(root, g);
-                bb_set_swap_colors(g, x);
-            }
-        }
-    }
-}
-
-internal bool bb_set_insert(Arena* arena, BBSetNode** root, IRBasicBlock* b) {
-    assert(!(*root) || (*root)->color == RBT_BLACK);
-    BBSetNode* x = bb_bst_insert(arena, root, b, 0);
-    bb_set_repair(root, x);
-    return x != 0;
-}
-
-typedef struct {
-    BBSetNode* cur;
-    BBSetNode* right_most;
-    IRBasicBlock* val;
-} BBSetIter;
-
-internal void bb_set_next(BBSetIter* it) {
-    if (!it->cur) {
-        it->val = 0;
-        return;
-    }
-
-    if (!it->cur->l) {
-        it->val = it->cur->b;
-        it->cur = it->cur->r;
-    }
-    else {
-        it->right_most = it->cur->l;
-
-        while (it->right_most->r && it->right_most->r != it->cur)
-            it->right_most = it->right_most->r;
-
-        if (!it->right_most->r) {
-            it->right_most->r = it->cur;
-            it->cur = it->cur->l;
-            bb_set_next(it);
-        }
-        else {
-            it->right_most->r = 0; // Repair the tree
-            it->val = it->cur->b;
-            it->cur = it->cur->r;
-        }
-    }
-}
-
-internal BBSetIter bb_set_begin(BBSetNode* root) {
-    BBSetIter it = {
-        .cur = root
-    };
-
-    bb_set_next(&it);
-
-    return it;
-}
-
-internal int bb_set_count(BBSetNode* root) {
-    if (!root) {
-        return 0;
-    }
-
-    return bb_set_count(root->l) + bb_set_count(root->r) + 1;
-}
-
-#define FOREACH_BB_SET(it, set) for (BBSetIter it = bb_set_begin(set); it.val; bb_set_next(&it))
-
 enum {
     BB_WORKED = BIT(0),
     BB_HAS_PHI = BIT(1)
@@ -247,7 +22,7 @@ internal IRReg new_name(IR* ir, IRReg* cur_regs, IRAllocation* a) {
     return cur_regs[a->id];
 } 
 
-internal void promote_allocations(IR* ir, IRReg* cur_regs, int nalloc, BBSetNode** dom_children, IRBasicBlock* b) {
+internal void promote_allocations(IR* ir, IRReg* cur_regs, int nalloc, IRAnalysis* an, IRBasicBlock* b) {
     Scratch scratch = get_scratch(0, 0);
 
     IRReg* cur_regs_temp = arena_push_array(scratch.arena, IRReg, nalloc);
@@ -322,8 +97,8 @@ internal void promote_allocations(IR* ir, IRReg* cur_regs, int nalloc, BBSetNode
         }
     }
 
-    FOREACH_BB_SET(it, dom_children[b->id]) {
-        promote_allocations(ir, cur_regs, nalloc, dom_children, it.val);
+    FOREACH_DOM_CHILD(child, an, b) {
+        promote_allocations(ir, cur_regs, nalloc, an, *child);
     }
 
     memcpy(cur_regs, cur_regs_temp, nalloc * sizeof(IRReg));
@@ -331,104 +106,61 @@ internal void promote_allocations(IR* ir, IRReg* cur_regs, int nalloc, BBSetNode
 }
 
 internal void mem2reg(Arena* arena, IR* ir) {
-    Scratch scratch = get_scratch(0, 0);
-
-    int max_bb_id = -1;
-    FOREACH_IR_BB(b, ir->first_block)
-        max_bb_id = b->id > max_bb_id ? b->id : max_bb_id;
-
-    assert(max_bb_id >= 0);
-    int nblock = max_bb_id + 1;
+    Scratch scratch = get_scratch(&arena, 1);
 
-    int max_alloc_id = -1;
-    for (IRAllocation* a = ir->first_allocation; a; a = a->next)
-        max_alloc_id = a->id > max_alloc_id ? a->id : max_alloc_id;
-
-    int nalloc = max_alloc_id + 1;
+    int nblock = ir_block_count(ir);
+    assert(nblock > 0);
 
-    // Post-order needed for dominance calculation
-    PostOrder po = {
-        .traversed = arena_push_array(scratch.arena, bool, nblock),
-        .indices = arena_push_array(scratch.arena, int, nblock),
-        .order = arena_push_array(scratch.arena, IRBasicBlock*, nblock),
-    };
-    get_post_order(&po, ir->first_block);
+    int nalloc = ir_allocation_count(ir);
 
-    // Gather predecessors
-    BBSetNode** pred = arena_push_array(scratch.arena, BBSetNode*, nblock);
-    FOREACH_IR_BB(b, ir->first_block) {
-        BBList succ = bb_get_succ(b);
-        for (int i = 0; i < succ.count; ++i) {
-            IRBasicBlock* s = succ.data[i];
-            bb_set_insert(scratch.arena, &pred[s->id], b);
-        }
-    }
+    IRAnalysis* an = get_ir_analysis(ir, ANALYSIS_CFG | ANALYSIS_DOM | ANALYSIS_INSTRS);
+    IRBasicBlock** idom = an->idom;
 
-    // Compute dominance information
-    IRBasicBlock** idom = arena_push_array(scratch.arena, IRBasicBlock*, nblock);
-    idom[ir->first_block->id] = ir->first_block;
+    // Compute dominance frontiers. The frontier of block b is
+    // df[df_offset[b]..df_offset[b+1]]; the first pass counts, the second fills.
+    int* df_offset = arena_push_array(scratch.arena, int, nblock + 1);
+    int* df_fill = arena_push_array(scratch.arena, int, nblock);
+    IRBasicBlock** df_last = arena_push_array(scratch.arena, IRBasicBlock*, nblock);
+    IRBasicBlock** df = 0;
 
-    for (;;) {
-        bool changed = false;
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        memset(df_last, 0, nblock * sizeof(df_last[0]));
 
-        for (int i = po.count-1; i >= 0; --i)
+        FOREACH_IR_BB(n, ir->first_block)
         {
-            IRBasicBlock* b = po.order[i];
-            if (b == ir->first_block)
+            if (!idom[n->id] || an->pred_offset[n->id + 1] - an->pred_offset[n->id] <= 1)
                 continue;
 
-            BBSetIter it = bb_set_begin(pred[b->id]);
-
-            IRBasicBlock* new_idom = it.val;
-            assert(new_idom);
-            bb_set_next(&it);
-
-            for (; it.val; bb_set_next(&it))
+            FOREACH_PRED(p, an, n)
             {
-                IRBasicBlock* p = it.val;
-                if (idom[p->id])
-                    new_idom = first_common_dominator(idom, &po, p, new_idom);
-            }
-
-            if (idom[b->id] != new_idom) {
-                idom[b->id] = new_idom;
-                changed = true;
-            }
-        }
-
-        if (!changed)
-            break;
-    }
-
-    idom[ir->first_block->id] = 0;
-
-    BBSetNode** dom_children = arena_push_array(scratch.arena, BBSetNode*, nblock);
-    FOREACH_IR_BB(n, ir->first_block) {
-        IRBasicBlock* dom = idom[n->id];
-        if (dom)
-            bb_set_insert(scratch.arena, &dom_children[dom->id], n);
-    }
+                IRBasicBlock* runner = *p;
 
-    // Compute dominance frontiers
-    BBSetNode** df = arena_push_array(scratch.arena, BBSetNode*, nblock);
-    FOREACH_IR_BB(n, ir->first_block)
-    {
-        if (!idom[n->id] || bb_set_count(pred[n->id]) <= 1)
-            continue;
+                // Runners from different preds of n meet before idom(n), so
+                // remembering the last join seen is enough to keep entries unique.
+                while (runner && runner != idom[n->id] && df_last[runner->id] != n)
+                {
+                    if (!idom[runner->id])
+                        break;
 
-        FOREACH_BB_SET(it, pred[n->id])
-        {
-            IRBasicBlock* runner = it.val;
+                    df_last[runner->id] = n;
 
-            while (runner && runner != idom[n->id])
-            {
-                if (!idom[runner->id])
-                    break;
+                    if (pass == 0)
+                        df_offset[runner->id + 1]++;
+                    else
+                        df[df_fill[runner->id]++] = n;
 
-                bb_set_insert(scratch.arena, &df[runner->id], n);
-                runner = idom[runner->id];
+                    runner = idom[runner->id];
+                }
             }
         }
+
+        if (pass == 0) {
+            for (int i = 0; i < nblock; ++i)
+                df_offset[i + 1] += df_offset[i];
+            memcpy(df_fill, df_offset, nblock * sizeof(int));
+            df = arena_push_array(scratch.arena, IRBasicBlock*, df_offset[nblock]);
+        }
     }
 
     // Get liveness information
@@ -441,85 +173,71 @@ internal void mem2reg(Arena* arena, IR* ir) {
         var_kill[b->id] = bitset_alloc(scratch.arena, nalloc);
         ue_var[b->id]   = bitset_alloc(scratch.arena, nalloc);
         live_out[b->id] = bitset_alloc(scratch.arena, nalloc);
+    }
+
+    FlatIR* f = &an->instrs;
+    for (u32 i = 0; i < f->instr_count; ++i)
+    {
+        u32 b = f->block[i];
+        u32 loc = f->operand_offset[i];
 
-        IRInstr* instr = b->start;
-        for (int i = 0; i < b->len; ++i)
+        switch (f->op[i])
         {
-            switch (instr->op)
-            {
-                case IR_OP_STORE: {
-                    assert(instr->store.loc.kind == IR_VALUE_ALLOCATION);
-                    IRAllocation* a = instr->store.loc.allocation;
-                    bitset_set(var_kill[b->id], a->id);
-                } break;
-
-                case IR_OP_LOAD: {
-                    assert(instr->load.loc.kind == IR_VALUE_ALLOCATION);
-                    IRAllocation* a = instr->load.loc.allocation;
-                    if (!bitset_get(var_kill[b->id], a->id))
-                        bitset_set(ue_var[b->id], a->id);
-                } break;
-            }
+            case IR_OP_STORE:
+                assert(f->operand_kind[loc] == IR_VALUE_ALLOCATION);
+                bitset_set(var_kill[b], (u32)f->operand_val[loc]);
+                break;
 
-            instr = instr->next;
+            case IR_OP_LOAD:
+                assert(f->operand_kind[loc] == IR_VALUE_ALLOCATION);
+                if (!bitset_get(var_kill[b], (u32)f->operand_val[loc]))
+                    bitset_set(ue_var[b], (u32)f->operand_val[loc]);
+                break;
         }
     }
 
-    for (;;) {
-        bool changed = false;
+    solve_live_out(ir, nalloc, ue_var, var_kill, live_out);
 
-        u32 num_u32 = num_u32_for_bits(nalloc);
+    // Gather the blocks that write to each allocation, in the same layout as df.
+    int* write_offset = arena_push_array(scratch.arena, int, nalloc + 1);
+    int* write_fill = arena_push_array(scratch.arena, int, nalloc);
+    u32* write_last = arena_push_array(scratch.arena, u32, nalloc);
+    IRBasicBlock** write_blocks = 0;
 
-        FOREACH_IR_BB(n, ir->first_block) {
-            BBList succ = bb_get_succ(n);
-            for (int s = 0; s < succ.count; ++s)
-            {
-                IRBasicBlock* m = succ.data[s];
-                for (u32 j = 0; j < num_u32; ++j)
-                {
-                    u32* dw = &live_out[n->id]->p[j];
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        memset(write_last, 0xff, nalloc * sizeof(write_last[0]));
 
-                    u32 ue_var_m   = ue_var  [m->id]->p[j];
-                    u32 live_out_m = live_out[m->id]->p[j];
-                    u32 var_kill_m = var_kill[m->id]->p[j];
+        for (u32 i = 0; i < f->instr_count; ++i)
+        {
+            if (f->op[i] != IR_OP_STORE)
+                continue;
 
-                    u32 add = ue_var_m | (live_out_m & ~var_kill_m);
-                    if ((add | *dw) != *dw) {
-                        changed = true;
-                        *dw |= add;
-                    }
-                }
+            u32 a = (u32)f->operand_val[f->operand_offset[i]];
+
+            if (write_last[a] != f->block[i]) {
+                write_last[a] = f->block[i];
+
+                if (pass == 0)
+                    write_offset[a + 1]++;
+                else
+                    write_blocks[write_fill[a]++] = f->node[i]->block;
             }
         }
 
-        if (!changed)
-            break;
+        if (pass == 0) {
+            for (int i = 0; i < nalloc; ++i)
+                write_offset[i + 1] += write_offset[i];
+            memcpy(write_fill, write_offset, nalloc * sizeof(int));
+            write_blocks = arena_push_array(scratch.arena, IRBasicBlock*, write_offset[nalloc]);
+        }
     }
 
-    // Gather information about allocations
-    BBSetNode** alloc_write_blocks = arena_push_array(scratch.arena, BBSetNode*, nalloc);
-    IRReg* alloc_cur_regs          = arena_push_array(scratch.arena, IRReg, nalloc);
-
+    IRReg* alloc_cur_regs = arena_push_array(scratch.arena, IRReg, nalloc);
     for (int i = 0; i < nalloc; ++i) {
         alloc_cur_regs[i] = IR_EMPTY_REG;
     }
 
-    // Gather the blocks that write to allocations
-    FOREACH_IR_BB(b, ir->first_block)
-    {
-        IRInstr* instr = b->start;
-        for (int i = 0; i < b->len; ++i)
-        {
-            if (instr->op == IR_OP_STORE) {
-                assert(instr->store.loc.kind == IR_VALUE_ALLOCATION);
-                IRAllocation* a = instr->store.loc.allocation;
-                bb_set_insert(scratch.arena, &alloc_write_blocks[a->id], b);
-            }
-
-            instr = instr->next;
-        }
-    }
-
     // Promote allocations to registers, rebuild SSA.
 
     int worklist_count;
@@ -531,23 +249,23 @@ internal void mem2reg(Arena* arena, IR* ir) {
         worklist_count = 0;
         memset(worked, 0, nblock * sizeof(worked[0]));
 
-        FOREACH_BB_SET(it, alloc_write_blocks[a->id]) {
-            add_to_worklist(worked, &worklist_count, worklist, it.val);
+        for (int i = write_offset[a->id]; i < write_offset[a->id + 1]; ++i) {
+            add_to_worklist(worked, &worklist_count, worklist, write_blocks[i]);
         }
 
         while (worklist_count > 0) // Blocks that write to this allocation
         {
             IRBasicBlock* write_block = worklist[--worklist_count];
 
-            FOREACH_BB_SET(it, df[write_block->id])
+            for (int j = df_offset[write_block->id]; j < df_offset[write_block->id + 1]; ++j)
             {
-                IRBasicBlock* d = it.val;
+                IRBasicBlock* d = df[j];
 
                 bool phi_needed = bitset_get(live_out[d->id], a->id) || bitset_get(ue_var[d->id], a->id);
 
                 if (phi_needed && !(worked[d->id] & BB_HAS_PHI))
                 {
-                    int param_count = bb_set_count(pred[d->id]);
+                    int param_count = an->pred_offset[d->id + 1] - an->pred_offset[d->id];
                     assert(param_count > 0);
 
                     IRInstr* instr = new_ir_instr(arena, IR_OP_PHI);
@@ -557,13 +275,13 @@ internal void mem2reg(Arena* arena, IR* ir) {
                     instr->phi.a = a;
 
                     int counter = 0;
-                    FOREACH_BB_SET(it2, pred[d->id]) {
+                    FOREACH_PRED(p, an, d) {
                         int i = counter++;
-                        instr->phi.params[i].block = it2.val;
+                        instr->phi.params[i].block = *p;
                         instr->phi.params[i].reg = IR_EMPTY_REG;
                     }
 
-                    insert_ir_instr_at_block_start(ir, d, instr);
+                    insert_ir_instr_at_block_start(d, instr);
                     
                     worked[d->id] |= BB_HAS_PHI;
 
@@ -573,11 +291,1242 @@ internal void mem2reg(Arena* arena, IR* ir) {
         }
     }
 
-    promote_allocations(ir, alloc_cur_regs, nalloc, dom_children, ir->first_block);
+    promote_allocations(ir, alloc_cur_regs, nalloc, an, ir->first_block);
+
+    invalidate_ir_analysis(ir, ANALYSIS_INSTRS);
 
     release_scratch(&scratch);
 }
 
-void optimize(Arena* arena, IR* ir) {
-    mem2reg(arena, ir);
-}
\ No newline at end of file
+typedef enum {
+    LATTICE_TOP,
+    LATTICE_CONST,
+    LATTICE_BOTTOM,
+} LatticeState;
+
+typedef struct {
+    LatticeState state;
+    i64 val;
+} LatticeValue;
+
+typedef struct {
+    IRBasicBlock* from;
+    int succ_index;
+} CFGEdge;
+
+typedef struct {
+    LatticeValue* values;
+    bool* block_exec;
+    u8* edge_exec;
+    u8* edge_queued;
+
+    int* use_offset;
+    IRInstr** uses;
+
+    int cfg_count;
+    CFGEdge* cfg_worklist;
+
+    int ssa_count;
+    IRInstr** ssa_worklist;
+} SCCP;
+
+internal LatticeValue lattice_meet(LatticeValue a, LatticeValue b) {
+    if (a.state == LATTICE_TOP)
+        return b;
+    if (b.state == LATTICE_TOP)
+        return a;
+    if (a.state == LATTICE_CONST && b.state == LATTICE_CONST && a.val == b.val)
+        return a;
+    return (LatticeValue) { .state = LATTICE_BOTTOM };
+}
+
+internal LatticeValue sccp_value(SCCP* s, IRValue value) {
+    switch (value.kind) {
+        default:
+            return (LatticeValue) { .state = LATTICE_BOTTOM };
+        case IR_VALUE_REG:
+            return s->values[value.reg];
+        case IR_VALUE_INTEGER:
+            return (LatticeValue) { .state = LATTICE_CONST, .val = (i64)value.integer };
+    }
+}
+
+// The value of `val` read as `type`, extended back to 64 bits.
+internal i64 fold_to_type(IRType type, i64 val) {
+    static_assert(NUM_IR_TYPES == 9, "not all ir types handled");
+    switch (type) {
+        default:
+            assert(false);
+            return val;
+        case IR_TYPE_I8:
+            return (i8)val;
+        case IR_TYPE_I16:
+            return (i16)val;
+        case IR_TYPE_I32:
+            return (i32)val;
+        case IR_TYPE_I64:
+            return val;
+        case IR_TYPE_U8:
+            return (u8)val;
+        case IR_TYPE_U16:
+            return (u16)val;
+        case IR_TYPE_U32:
+            return (u32)val;
+        case IR_TYPE_U64:
+            return (i64)(u64)val;
+    }
+}
+
+// Folds with the width and signedness of `type`, like the VM and the JIT.
+internal bool fold_binary(IROpCode op, IRType type, i64 l, i64 r, i64* result) {
+    l = fold_to_type(type, l);
+    r = fold_to_type(type, r);
+    bool is_signed = ir_type_is_signed(type);
+
+    switch (op) {
+        default:
+            assert(false);
+            return false;
+        case IR_OP_ADD:
+            *result = fold_to_type(type, (i64)((u64)l + (u64)r));
+            return true;
+        case IR_OP_SUB:
+            *result = fold_to_type(type, (i64)((u64)l - (u64)r));
+            return true;
+        case IR_OP_MUL:
+            *result = fold_to_type(type, (i64)((u64)l * (u64)r));
+            return true;
+        case IR_OP_DIV:
+            if (r == 0)
+                return false;
+            if (is_signed && r == -1)
+                *result = fold_to_type(type, (i64)(0 - (u64)l)); // MIN / -1 wraps
+            else
+                *result = fold_to_type(type, is_signed ? l / r : (i64)((u64)l / (u64)r));
+            return true;
+        case IR_OP_LESS:
+            *result = is_signed ? l < r : (u64)l < (u64)r;
+            return true;
+        case IR_OP_LEQUAL:
+            *result = is_signed ? l <= r : (u64)l <= (u64)r;
+            return true;
+        case IR_OP_NEQUAL:
+            *result = l != r;
+            return true;
+        case IR_OP_EQUAL:
+            *result = l == r;
+            return true;
+    }
+}
+
+internal void sccp_add_edge(SCCP* s, IRBasicBlock* from, int succ_index) {
+    u8 bit = (u8)BIT(succ_index);
+    if (s->edge_queued[from->id] & bit)
+        return;
+    s->edge_queued[from->id] |= bit;
+    s->cfg_worklist[s->cfg_count++] = (CFGEdge) { .from = from, .succ_index = succ_index };
+}
+
+internal bool sccp_edge_exec(SCCP* s, IRBasicBlock* from, IRBasicBlock* to) {
+    BBList succ = bb_get_succ(from);
+    for (int k = 0; k < succ.count; ++k) {
+        if (succ.data[k] == to && (s->edge_exec[from->id] & BIT(k)))
+            return true;
+    }
+    return false;
+}
+
+internal void sccp_set(SCCP* s, IRReg reg, LatticeValue value) {
+    LatticeValue* cur = &s->values[reg];
+    if (cur->state == value.state && (value.state != LATTICE_CONST || cur->val == value.val))
+        return;
+
+    assert(value.state > cur->state);
+    *cur = value;
+
+    for (int i = s->use_offset[reg]; i < s->use_offset[reg + 1]; ++i)
+        s->ssa_worklist[s->ssa_count++] = s->uses[i];
+}
+
+internal void sccp_visit(SCCP* s, IRInstr* instr) {
+    static_assert(NUM_IR_OPS == 19, "not all ir ops handled");
+    switch (instr->op) {
+        default:
+            assert(false);
+            break;
+
+        case IR_OP_PHI: {
+            LatticeValue result = { .state = LATTICE_TOP };
+            for (int i = 0; i < instr->phi.param_count; ++i) {
+                IRPhiParam* param = &instr->phi.params[i];
+                if (param->reg != IR_EMPTY_REG && sccp_edge_exec(s, param->block, instr->block))
+                    result = lattice_meet(result, s->values[param->reg]);
+            }
+            sccp_set(s, instr->phi.dest, result);
+        } break;
+
+        case IR_OP_COPY:
+            sccp_set(s, instr->copy.dest, sccp_value(s, instr->copy.src));
+            break;
+
+        // Extension reads the source type; a truncated value is only ever
+        // read at its narrower type.
+        case IR_OP_SEXT:
+        case IR_OP_ZEXT: {
+            LatticeValue value = sccp_value(s, instr->cast.src);
+            if (value.state == LATTICE_CONST)
+                value.val = fold_to_type(instr->cast.type_src, value.val);
+            sccp_set(s, instr->cast.dest, value);
+        } break;
+
+        case IR_OP_TRUNC:
+            sccp_set(s, instr->cast.dest, sccp_value(s, instr->cast.src));
+            break;
+
+        case IR_OP_LOAD:
+            sccp_set(s, instr->load.dest, (LatticeValue) { .state = LATTICE_BOTTOM });
+            break;
+
+        case IR_OP_STORE:
+        case IR_OP_RET:
+            break;
+
+        case IR_OP_ADD:
+        case IR_OP_SUB:
+        case IR_OP_MUL:
+        case IR_OP_DIV:
+        case IR_OP_LESS:
+        case IR_OP_LEQUAL:
+        case IR_OP_NEQUAL:
+        case IR_OP_EQUAL:
+        {
+            LatticeValue l = sccp_value(s, instr->bin.l);
+            LatticeValue r = sccp_value(s, instr->bin.r);
+            LatticeValue result = { .state = LATTICE_BOTTOM };
+
+            if (l.state == LATTICE_TOP || r.state == LATTICE_TOP) {
+                if (l.state != LATTICE_BOTTOM && r.state != LATTICE_BOTTOM)
+                    result.state = LATTICE_TOP;
+            }
+            else if (l.state == LATTICE_CONST && r.state == LATTICE_CONST) {
+                if (fold_binary(instr->op, instr->bin.type, l.val, r.val, &result.val))
+                    result.state = LATTICE_CONST;
+            }
+
+            sccp_set(s, instr->bin.dest, result);
+        } break;
+
+        case IR_OP_JMP:
+            sccp_add_edge(s, instr->block, 0);
+            break;
+
+        // An undecided condition takes both edges, which keeps the CFG intact
+        // if it never settles.
+        case IR_OP_BRANCH: {
+            LatticeValue cond = sccp_value(s, instr->branch.cond);
+            if (cond.state == LATTICE_CONST) {
+                sccp_add_edge(s, instr->block, fold_to_type(instr->branch.type, cond.val) ? 0 : 1);
+            }
+            else {
+                sccp_add_edge(s, instr->block, 0);
+                sccp_add_edge(s, instr->block, 1);
+            }
+        } break;
+    }
+}
+
+internal void sccp_visit_block(SCCP* s, IRBasicBlock* b, bool phis_only) {
+    IRInstr* instr = b->start;
+    for (int i = 0; i < b->len; ++i) {
+        if (phis_only && instr->op != IR_OP_PHI)
+            break;
+        sccp_visit(s, instr);
+        instr = instr->next;
+    }
+
+    if (!phis_only && !bb_is_terminated(b) && bb_get_succ(b).count > 0)
+        sccp_add_edge(s, b, 0);
+}
+
+internal void remove_phi_params_from(IRBasicBlock* b, IRBasicBlock* pred) {
+    IRInstr* instr = b->start;
+    for (int i = 0; i < b->len && instr->op == IR_OP_PHI; ++i)
+    {
+        for (int k = 0; k < instr->phi.param_count;) {
+            if (instr->phi.params[k].block == pred)
+                instr->phi.params[k] = instr->phi.params[--instr->phi.param_count];
+            else
+                ++k;
+        }
+
+        instr = instr->next;
+    }
+}
+
+internal IRInstr* first_non_phi(IRBasicBlock* b) {
+    IRInstr* instr = b->start;
+    for (int i = 0; i < b->len; ++i) {
+        if (instr->op != IR_OP_PHI)
+            return instr;
+        instr = instr->next;
+    }
+    return 0;
+}
+
+// Sparse conditional constant propagation (Wegman & Zadeck). Runs on SSA form.
+internal void sccp(Arena* arena, IR* ir) {
+    Scratch scratch = get_scratch(&arena, 1);
+
+    u32 nblock = (u32)ir_block_count(ir);
+    u32 nreg = ir->next_reg;
+
+    SCCP s = {
+        .values = arena_push_array(scratch.arena, LatticeValue, nreg),
+        .block_exec = arena_push_array(scratch.arena, bool, nblock),
+        .edge_exec = arena_push_array(scratch.arena, u8, nblock),
+        .edge_queued = arena_push_array(scratch.arena, u8, nblock),
+        .use_offset = arena_push_array(scratch.arena, int, nreg + 1),
+        .cfg_worklist = arena_push_array(scratch.arena, CFGEdge, nblock * 2),
+    };
+
+    // Def-use chains
+    FOREACH_IR_BB(b, ir->first_block)
+    FOREACH_IR_INSTR(instr, b)
+    {
+        IRValue* operands[2];
+        int operand_count = ir_instr_operands(instr, operands);
+        for (int i = 0; i < operand_count; ++i) {
+            if (operands[i]->kind == IR_VALUE_REG)
+                s.use_offset[operands[i]->reg + 1]++;
+        }
+
+        if (instr->op == IR_OP_PHI) {
+            for (int i = 0; i < instr->phi.param_count; ++i) {
+                if (instr->phi.params[i].reg != IR_EMPTY_REG)
+                    s.use_offset[instr->phi.params[i].reg + 1]++;
+            }
+        }
+    }
+
+    for (u32 r = 0; r < nreg; ++r)
+        s.use_offset[r + 1] += s.use_offset[r];
+
+    int nuse = s.use_offset[nreg];
+    s.uses = arena_push_array(scratch.arena, IRInstr*, nuse);
+    s.ssa_worklist = arena_push_array(scratch.arena, IRInstr*, nuse * 2);
+
+    int* use_fill = arena_push_array(scratch.arena, int, nreg);
+    memcpy(use_fill, s.use_offset, nreg * sizeof(int));
+
+    FOREACH_IR_BB(b, ir->first_block)
+    FOREACH_IR_INSTR(instr, b)
+    {
+        IRValue* operands[2];
+        int operand_count = ir_instr_operands(instr, operands);
+        for (int i = 0; i < operand_count; ++i) {
+            if (operands[i]->kind == IR_VALUE_REG)
+                s.uses[use_fill[operands[i]->reg]++] = instr;
+        }
+
+        if (instr->op == IR_OP_PHI) {
+            for (int i = 0; i < instr->phi.param_count; ++i) {
+                if (instr->phi.params[i].reg != IR_EMPTY_REG)
+                    s.uses[use_fill[instr->phi.params[i].reg]++] = instr;
+            }
+        }
+    }
+
+    // Propagate
+    s.block_exec[ir->first_block->id] = true;
+    sccp_visit_block(&s, ir->first_block, false);
+
+    while (s.cfg_count > 0 || s.ssa_count > 0)
+    {
+        while (s.cfg_count > 0)
+        {
+            CFGEdge e = s.cfg_worklist[--s.cfg_count];
+            s.edge_exec[e.from->id] |= (u8)BIT(e.succ_index);
+
+            IRBasicBlock* to = bb_get_succ(e.from).data[e.succ_index];
+
+            // A newly executable edge into a visited block can only change its phis.
+            bool visited = s.block_exec[to->id];
+            s.block_exec[to->id] = true;
+            sccp_visit_block(&s, to, visited);
+        }
+
+        while (s.ssa_count > 0)
+        {
+            IRInstr* instr = s.ssa_worklist[--s.ssa_count];
+            if (s.block_exec[instr->block->id])
+                sccp_visit(&s, instr);
+        }
+    }
+
+    // Rewrite
+    FOREACH_IR_BB(b, ir->first_block)
+    {
+        if (!s.block_exec[b->id])
+            continue;
+
+        // Snapshot the block, rewriting phis inserts copies into it.
+        int len = b->len;
+        IRInstr** instrs = arena_push_array(scratch.arena, IRInstr*, len);
+        IRInstr* it = b->start;
+        for (int i = 0; i < len; ++i) {
+            instrs[i] = it;
+            it = it->next;
+        }
+
+        for (int i = 0; i < len; ++i)
+        {
+            IRInstr* instr = instrs[i];
+
+            IRValue* operands[2];
+            int operand_count = ir_instr_operands(instr, operands);
+            for (int k = 0; k < operand_count; ++k) {
+                IRValue* v = operands[k];
+                if (v->kind == IR_VALUE_REG && s.values[v->reg].state == LATTICE_CONST)
+                    *v = ir_integer_value((u64)s.values[v->reg].val);
+            }
+
+            IRReg* dest = ir_instr_dest(instr);
+            if (dest && s.values[*dest].state == LATTICE_CONST && instr->op != IR_OP_COPY)
+            {
+                // Keep the definition around as a copy, phi operands can only name registers.
+                IRReg reg = *dest;
+                IRType type = IR_TYPE_I64;
+
+                switch (instr->op) {
+                    case IR_OP_PHI:
+                        type = instr->phi.type;
+                        break;
+                    case IR_OP_SEXT:
+                    case IR_OP_ZEXT:
+                    case IR_OP_TRUNC:
+                        type = instr->cast.type_dest;
+                        break;
+                    default:
+                        type = instr->bin.type;
+                        break;
+                }
+
+                if (instr->op == IR_OP_PHI) {
+                    IRInstr* copy = new_ir_instr(arena, IR_OP_COPY);
+                    copy->copy.type = type;
+                    copy->copy.dest = reg;
+                    copy->copy.src = ir_integer_value((u64)s.values[reg].val);
+
+                    IRInstr* at = first_non_phi(b);
+                    if (at)
+                        insert_ir_instr_before(at, copy);
+                    else
+                        append_ir_instr(b, copy);
+
+                    remove_ir_instr(instr);
+                }
+                else {
+                    instr->op = IR_OP_COPY;
+                    instr->copy.type = type;
+                    instr->copy.dest = reg;
+                    instr->copy.src = ir_integer_value((u64)s.values[reg].val);
+                }
+            }
+
+            if (instr->op == IR_OP_BRANCH && instr->branch.cond.kind == IR_VALUE_INTEGER) {
+                bool cond = fold_to_type(instr->branch.type, (i64)instr->branch.cond.integer) != 0;
+                IRBasicBlock* taken = cond ? instr->branch.then_loc : instr->branch.els_loc;
+                IRBasicBlock* not_taken = cond ? instr->branch.els_loc : instr->branch.then_loc;
+
+                if (not_taken != taken)
+                    remove_phi_params_from(not_taken, b);
+
+                instr->op = IR_OP_JMP;
+                instr->jmp_loc = taken;
+            }
+        }
+    }
+
+    // Drop unreachable blocks
+    IRBasicBlock* prev = 0;
+    FOREACH_IR_BB(b, ir->first_block)
+    {
+        if (s.block_exec[b->id]) {
+            prev = b;
+            continue;
+        }
+
+        BBList succ = bb_get_succ(b);
+        for (int k = 0; k < succ.count; ++k)
+            remove_phi_params_from(succ.data[k], b);
+
+        while (b->len > 0)
+            remove_ir_instr(b->start);
+
+        assert(prev);
+        prev->next = b->next;
+    }
+
+    invalidate_ir_analysis(ir, ANALYSIS_CFG);
+
+    release_scratch(&scratch);
+}
+
+internal IRInstr** find_defs(Arena* arena, IR* ir) {
+    IRInstr** defs = arena_push_array(arena, IRInstr*, ir->next_reg);
+    FOREACH_IR_BB(b, ir->first_block) {
+        FOREACH_IR_INSTR(instr, b) {
+            IRReg* dest = ir_instr_dest(instr);
+            if (dest)
+                defs[*dest] = instr;
+        }
+    }
+    return defs;
+}
+
+internal IRValue resolve_copies(IRInstr** defs, IRValue value) {
+    while (value.kind == IR_VALUE_REG && defs[value.reg] && defs[value.reg]->op == IR_OP_COPY)
+        value = defs[value.reg]->copy.src;
+    return value;
+}
+
+// Rewrites uses of copies to the copied value. The copies themselves are left
+// for dead_code_elimination() to remove.
+internal void copy_propagation(Arena* arena, IR* ir) {
+    Scratch scratch = get_scratch(&arena, 1);
+
+    IRInstr** defs = find_defs(scratch.arena, ir);
+
+    FOREACH_IR_BB(b, ir->first_block)
+    FOREACH_IR_INSTR(instr, b)
+    {
+        if (instr->op == IR_OP_PHI) {
+            // Phi parameters can only name registers, so constants stay behind their copies.
+            for (int i = 0; i < instr->phi.param_count; ++i) {
+                IRPhiParam* param = &instr->phi.params[i];
+                if (param->reg == IR_EMPTY_REG)
+                    continue;
+
+                IRValue v = resolve_copies(defs, ir_reg_value(param->reg));
+                if (v.kind == IR_VALUE_REG)
+                    param->reg = v.reg;
+            }
+            continue;
+        }
+
+        IRValue* operands[2];
+        int operand_count = ir_instr_operands(instr, operands);
+        for (int i = 0; i < operand_count; ++i)
+            *operands[i] = resolve_copies(defs, *operands[i]);
+    }
+
+    invalidate_ir_analysis(ir, ANALYSIS_INSTRS);
+
+    release_scratch(&scratch);
+}
+
+internal bool has_side_effects(IRInstr* instr) {
+    static_assert(NUM_IR_OPS == 19, "not all ir ops handled");
+    switch (instr->op) {
+        default:
+            return false;
+        case IR_OP_STORE:
+        case IR_OP_RET:
+        case IR_OP_JMP:
+        case IR_OP_BRANCH:
+            return true;
+    }
+}
+
+// Removes every instruction whose result is never used by an instruction with
+// side effects.
+internal void dead_code_elimination(Arena* arena, IR* ir) {
+    Scratch scratch = get_scratch(&arena, 1);
+
+    IRInstr** defs = find_defs(scratch.arena, ir);
+    Bitset* live = bitset_alloc(scratch.arena, ir->next_reg);
+
+    int worklist_count = 0;
+    IRInstr** worklist = arena_push_array(scratch.arena, IRInstr*, ir->next_reg);
+
+    FOREACH_IR_BB(b, ir->first_block)
+    FOREACH_IR_INSTR(instr, b)
+    {
+        if (!has_side_effects(instr))
+            continue;
+
+        IRValue* operands[2];
+        int operand_count = ir_instr_operands(instr, operands);
+        for (int i = 0; i < operand_count; ++i) {
+            IRReg r = operands[i]->reg;
+            if (operands[i]->kind == IR_VALUE_REG && !bitset_get(live, r)) {
+                bitset_set(live, r);
+                worklist[worklist_count++] = defs[r];
+            }
+        }
+    }
+
+    while (worklist_count > 0)
+    {
+        IRInstr* instr = worklist[--worklist_count];
+
+        IRValue* operands[2];
+        int operand_count = ir_instr_operands(instr, operands);
+        for (int i = 0; i < operand_count; ++i) {
+            IRReg r = operands[i]->reg;
+            if (operands[i]->kind == IR_VALUE_REG && !bitset_get(live, r)) {
+                bitset_set(live, r);
+                worklist[worklist_count++] = defs[r];
+            }
+        }
+
+        if (instr->op == IR_OP_PHI) {
+            for (int i = 0; i < instr->phi.param_count; ++i) {
+                IRReg r = instr->phi.params[i].reg;
+                if (r != IR_EMPTY_REG && !bitset_get(live, r)) {
+                    bitset_set(live, r);
+                    worklist[worklist_count++] = defs[r];
+                }
+            }
+        }
+    }
+
+    FOREACH_IR_BB(b, ir->first_block)
+    {
+        for (IRInstr* instr = b->start; instr;)
+        {
+            IRInstr* next = instr->next;
+
+            IRReg* dest = ir_instr_dest(instr);
+            if (dest && !bitset_get(live, *dest))
+                remove_ir_instr(instr);
+
+            instr = next;
+        }
+    }
+
+    invalidate_ir_analysis(ir, ANALYSIS_INSTRS);
+
+    release_scratch(&scratch);
+}
+
+typedef struct GVNEntry GVNEntry;
+struct GVNEntry {
+    GVNEntry* next;
+    GVNEntry* scope_next;
+    u64 hash;
+    IROpCode op;
+    IRType type_a;
+    IRType type_b;
+    IRValue l;
+    IRValue r;
+    IRReg reg;
+};
+
+typedef struct {
+    Arena* arena;
+    u32 bucket_mask;
+    GVNEntry** buckets;
+    IRReg* leaders;
+    IRAnalysis* an;
+} GVN;
+
+internal bool value_equal(IRValue a, IRValue b) {
+    if (a.kind != b.kind)
+        return false;
+
+    switch (a.kind) {
+        default:
+            assert(false);
+            return false;
+        case IR_VALUE_ILLEGAL:
+            return true;
+        case IR_VALUE_REG:
+            return a.reg == b.reg;
+        case IR_VALUE_INTEGER:
+            return a.integer == b.integer;
+        case IR_VALUE_ALLOCATION:
+            return a.allocation == b.allocation;
+    }
+}
+
+internal u64 hash_value(u64 h, IRValue value) {
+    u64 payload = value.kind == IR_VALUE_REG ? value.reg : value.integer;
+    h = (h ^ value.kind) * 0x100000001b3ull;
+    h = (h ^ payload) * 0x100000001b3ull;
+    return h;
+}
+
+internal bool is_commutative(IROpCode op) {
+    switch (op) {
+        default:
+            return false;
+        case IR_OP_ADD:
+        case IR_OP_MUL:
+        case IR_OP_NEQUAL:
+        case IR_OP_EQUAL:
+            return true;
+    }
+}
+
+internal IRValue gvn_operand(GVN* g, IRValue* value) {
+    if (value->kind == IR_VALUE_REG)
+        value->reg = g->leaders[value->reg];
+    return *value;
+}
+
+// Fills in the key of a pure instruction. Returns false for anything else.
+internal bool gvn_key(GVN* g, IRInstr* instr, GVNEntry* e) {
+    static_assert(NUM_IR_OPS == 19, "not all ir ops handled");
+    switch (instr->op) {
+        default:
+            return false;
+
+        case IR_OP_SEXT:
+        case IR_OP_ZEXT:
+        case IR_OP_TRUNC:
+            e->type_a = instr->cast.type_src;
+            e->type_b = instr->cast.type_dest;
+            e->l = gvn_operand(g, &instr->cast.src);
+            e->r = (IRValue) { 0 };
+            e->reg = instr->cast.dest;
+            break;
+
+        case IR_OP_ADD:
+        case IR_OP_SUB:
+        case IR_OP_MUL:
+        case IR_OP_DIV:
+        case IR_OP_LESS:
+        case IR_OP_LEQUAL:
+        case IR_OP_NEQUAL:
+        case IR_OP_EQUAL:
+        {
+            e->type_a = instr->bin.type;
+            e->type_b = IR_TYPE_ILLEGAL;
+            e->l = gvn_operand(g, &instr->bin.l);
+            e->r = gvn_operand(g, &instr->bin.r);
+            e->reg = instr->bin.dest;
+
+            // Order commutative operands so a+b and b+a share an entry.
+            if (is_commutative(instr->op)) {
+                u64 lk = hash_value(0, e->l);
+                u64 rk = hash_value(0, e->r);
+                if (lk > rk) {
+                    IRValue temp = e->l;
+                    e->l = e->r;
+                    e->r = temp;
+                }
+            }
+        } break;
+    }
+
+    e->op = instr->op;
+
+    u64 h = 0xcbf29ce484222325ull;
+    h = (h ^ e->op) * 0x100000001b3ull;
+    h = (h ^ e->type_a) * 0x100000001b3ull;
+    h = (h ^ e->type_b) * 0x100000001b3ull;
+    h = hash_value(h, e->l);
+    h = hash_value(h, e->r);
+    e->hash = h;
+
+    return true;
+}
+
+internal GVNEntry* gvn_lookup(GVN* g, GVNEntry* key) {
+    for (GVNEntry* e = g->buckets[key->hash & g->bucket_mask]; e; e = e->next) {
+        if (e->hash == key->hash && e->op == key->op && e->type_a == key->type_a && e->type_b == key->type_b &&
+            value_equal(e->l, key->l) && value_equal(e->r, key->r))
+        {
+            return e;
+        }
+    }
+    return 0;
+}
+
+// Walks the dominator tree, so any expression found in the table was computed
+// in a block that dominates the current one.
+internal void gvn_block(GVN* g, IRBasicBlock* b) {
+    GVNEntry* scope = 0;
+
+    IRInstr* instr = b->start;
+    for (int i = 0; i < b->len; ++i)
+    {
+        if (instr->op == IR_OP_PHI) {
+            for (int k = 0; k < instr->phi.param_count; ++k) {
+                IRPhiParam* param = &instr->phi.params[k];
+                if (param->reg != IR_EMPTY_REG)
+                    param->reg = g->leaders[param->reg];
+            }
+        }
+        else {
+            IRValue* operands[2];
+            int operand_count = ir_instr_operands(instr, operands);
+            for (int k = 0; k < operand_count; ++k)
+                gvn_operand(g, operands[k]);
+        }
+
+        GVNEntry key;
+        if (gvn_key(g, instr, &key))
+        {
+            GVNEntry* found = gvn_lookup(g, &key);
+            if (found) {
+                IRType type = key.type_b != IR_TYPE_ILLEGAL ? key.type_b : key.type_a;
+
+                g->leaders[key.reg] = found->reg;
+
+                instr->op = IR_OP_COPY;
+                instr->copy.type = type;
+                instr->copy.dest = key.reg;
+                instr->copy.src = ir_reg_value(found->reg);
+            }
+            else {
+                GVNEntry* e = arena_push_type(g->arena, GVNEntry);
+                *e = key;
+
+                u32 bucket = (u32)(e->hash & g->bucket_mask);
+                e->next = g->buckets[bucket];
+                g->buckets[bucket] = e;
+
+                e->scope_next = scope;
+                scope = e;
+            }
+        }
+
+        instr = instr->next;
+    }
+
+    FOREACH_DOM_CHILD(child, g->an, b) {
+        gvn_block(g, *child);
+    }
+
+    // Entries are always at the head of their bucket when their scope closes.
+    for (GVNEntry* e = scope; e; e = e->scope_next) {
+        u32 bucket = (u32)(e->hash & g->bucket_mask);
+        assert(g->buckets[bucket] == e);
+        g->buckets[bucket] = e->next;
+    }
+}
+
+// Dominator-based global value numbering. Redundant pure instructions become
+// copies of the dominating equivalent, cleaned up by copy propagation. The
+// dominator tree is the cached one, so it reflects SCCP's CFG changes.
+internal void gvn(Arena* arena, IR* ir) {
+    Scratch scratch = get_scratch(&arena, 1);
+
+    int ninstr = ir_instr_count(ir);
+
+    u32 bucket_count = 16;
+    while (bucket_count < (u32)ninstr * 2)
+        bucket_count *= 2;
+
+    GVN g = {
+        .arena = scratch.arena,
+        .bucket_mask = bucket_count - 1,
+        .buckets = arena_push_array(scratch.arena, GVNEntry*, bucket_count),
+        .leaders = arena_push_array(scratch.arena, IRReg, ir->next_reg),
+        .an = get_ir_analysis(ir, ANALYSIS_DOM),
+    };
+
+    for (IRReg r = 0; r < ir->next_reg; ++r)
+        g.leaders[r] = r;
+
+    gvn_block(&g, ir->first_block);
+
+    invalidate_ir_analysis(ir, ANALYSIS_INSTRS);
+
+    release_scratch(&scratch);
+}
+
+typedef struct Loop Loop;
+struct Loop {
+    IRBasicBlock* header;
+    Loop* parent;
+    IRBasicBlock* preheader;
+
+    // Every block of the loop, nested loops included, in reverse postorder.
+    int block_count;
+    IRBasicBlock** blocks;
+};
+
+typedef struct {
+    IR* ir;
+    IRAnalysis* an;
+    int next_block_id;
+
+    // Indexed by block id. loop_of_block maps a block to the innermost loop
+    // containing it, which is enough to answer membership through the parents.
+    Loop** loop_of_block;
+    Loop** loop_of_header;
+    IRBasicBlock** layout_prev;
+} LICM;
+
+internal bool loop_contains(LICM* m, Loop* loop, IRBasicBlock* b) {
+    for (Loop* l = m->loop_of_block[b->id]; l; l = l->parent) {
+        if (l == loop)
+            return true;
+    }
+    return false;
+}
+
+internal bool is_hoistable(IRInstr* instr) {
+    static_assert(NUM_IR_OPS == 19, "not all ir ops handled");
+    switch (instr->op) {
+        default:
+            return false;
+
+        case IR_OP_SEXT:
+        case IR_OP_ZEXT:
+        case IR_OP_TRUNC:
+        case IR_OP_ADD:
+        case IR_OP_SUB:
+        case IR_OP_MUL:
+        case IR_OP_LESS:
+        case IR_OP_LEQUAL:
+        case IR_OP_NEQUAL:
+        case IR_OP_EQUAL:
+            return true;
+
+        // Hoisting runs the instruction even if the loop body never would, so
+        // only divisions that cannot trap may move.
+        case IR_OP_DIV:
+            return instr->bin.r.kind == IR_VALUE_INTEGER && fold_to_type(instr->bin.type, (i64)instr->bin.r.integer) != 0;
+    }
+}
+
+// Gives the loop a single block to enter it through, laid out right before the
+// header. Outside predecessors are redirected to it and the header's phis take
+// a single value from it. Returns 0 if the loop can't be given one.
+internal IRBasicBlock* create_preheader(Arena* arena, LICM* m, Loop* loop) {
+    IRBasicBlock* header = loop->header;
+    IRBasicBlock* layout_pred = m->layout_prev[header->id];
+    if (!layout_pred)
+        return 0;
+
+    // A loop block falling into the header would fall into the preheader instead.
+    if (loop_contains(m, loop, layout_pred) && !bb_is_terminated(layout_pred))
+        return 0;
+
+    IRBasicBlock* pre = arena_push_type(arena, IRBasicBlock);
+    pre->id = m->next_block_id++;
+    pre->next = header;
+    layout_pred->next = pre;
+
+    m->layout_prev[pre->id] = layout_pred;
+    m->layout_prev[header->id] = pre;
+    m->loop_of_block[pre->id] = loop->parent;
+    loop->preheader = pre;
+
+    // Only the header's own preheader is ever inserted in front of it, so its
+    // cached predecessors are still exact.
+    FOREACH_PRED(p, m->an, header)
+    {
+        IRBasicBlock* b = *p;
+        if (loop_contains(m, loop, b) || b->len == 0)
+            continue;
+
+        IRInstr* end = b->end;
+        if (end->op == IR_OP_JMP && end->jmp_loc == header)
+            end->jmp_loc = pre;
+        if (end->op == IR_OP_BRANCH && end->branch.then_loc == header)
+            end->branch.then_loc = pre;
+        if (end->op == IR_OP_BRANCH && end->branch.els_loc == header)
+            end->branch.els_loc = pre;
+    }
+
+    IRInstr* instr = header->start;
+    for (int i = 0; i < header->len && instr->op == IR_OP_PHI; ++i)
+    {
+        int outside_count = 0;
+        for (int k = 0; k < instr->phi.param_count; ++k) {
+            if (!loop_contains(m, loop, instr->phi.params[k].block))
+                ++outside_count;
+        }
+
+        if (outside_count == 1) {
+            for (int k = 0; k < instr->phi.param_count; ++k) {
+                if (!loop_contains(m, loop, instr->phi.params[k].block))
+                    instr->phi.params[k].block = pre;
+            }
+        }
+        else if (outside_count > 1) {
+            IRInstr* phi = new_ir_instr(arena, IR_OP_PHI);
+            phi->phi.type = instr->phi.type;
+            phi->phi.dest = m->ir->next_reg++;
+            phi->phi.a = instr->phi.a;
+            phi->phi.params = arena_push_array(arena, IRPhiParam, outside_count);
+
+            int kept = 0;
+            for (int k = 0; k < instr->phi.param_count; ++k) {
+                IRPhiParam param = instr->phi.params[k];
+                if (loop_contains(m, loop, param.block))
+                    instr->phi.params[kept++] = param;
+                else
+                    phi->phi.params[phi->phi.param_count++] = param;
+            }
+
+            instr->phi.params[kept++] = (IRPhiParam) { .block = pre, .reg = phi->phi.dest };
+            instr->phi.param_count = kept;
+
+            insert_ir_instr_at_block_start(pre, phi);
+        }
+
+        instr = instr->next;
+    }
+
+    return pre;
+}
+
+// Collects the invariant instructions of a block. Blocks are visited in
+// reverse postorder, so every operand defined in the loop has been seen
+// before its uses and one pass finds them all, in an order where operands
+// come first.
+internal void find_invariants(LICM* m, Loop* loop, IRInstr** defs, Bitset* is_invariant, IRBasicBlock* b, IRInstr** invariant, int* invariant_count) {
+    FOREACH_IR_INSTR(instr, b)
+    {
+        if (!is_hoistable(instr))
+            continue;
+
+        bool operands_invariant = true;
+
+        IRValue* operands[2];
+        int operand_count = ir_instr_operands(instr, operands);
+        for (int k = 0; k < operand_count; ++k) {
+            if (operands[k]->kind != IR_VALUE_REG)
+                continue;
+
+            IRReg r = operands[k]->reg;
+            if (!bitset_get(is_invariant, r) && loop_contains(m, loop, defs[r]->block))
+                operands_invariant = false;
+        }
+
+        if (operands_invariant) {
+            bitset_set(is_invariant, *ir_instr_dest(instr));
+            invariant[(*invariant_count)++] = instr;
+        }
+    }
+}
+
+// Loop-invariant code motion. Natural loops are found from back edges, edges
+// whose target dominates their source, and processed innermost first so that
+// code hoisted out of an inner loop can keep moving outwards.
+internal void licm(Arena* arena, IR* ir) {
+    Scratch scratch = get_scratch(&arena, 1);
+
+    int nblock = ir_block_count(ir);
+    IRAnalysis* an = get_ir_analysis(ir, ANALYSIS_CFG | ANALYSIS_DOM);
+
+    // Every loop may add a preheader.
+    u32 max_blocks = (u32)nblock * 2;
+
+    LICM m = {
+        .ir = ir,
+        .an = an,
+        .next_block_id = nblock,
+        .loop_of_block = arena_push_array(scratch.arena, Loop*, max_blocks),
+        .loop_of_header = arena_push_array(scratch.arena, Loop*, (u32)nblock),
+        .layout_prev = arena_push_array(scratch.arena, IRBasicBlock*, max_blocks),
+    };
+
+    for (IRBasicBlock* b = ir->first_block; b->next; b = b->next)
+        m.layout_prev[b->next->id] = b;
+
+    int loop_count = 0;
+    Loop* loops = arena_push_array(scratch.arena, Loop, (u32)nblock);
+
+    // A loop pushes its latches and then each predecessor edge at most once.
+    IRBasicBlock** worklist = arena_push_array(scratch.arena, IRBasicBlock*, (u32)an->pred_offset[nblock] * 2);
+
+    // Headers are visited in reverse of reverse postorder, so inner loops are
+    // found before the loops around them. Walking back from the latches, a
+    // block that already belongs to a loop stands for that whole loop, which
+    // becomes a child of the current one.
+    for (int i = an->rpo_count - 1; i >= 0; --i)
+    {
+        IRBasicBlock* h = an->rpo[i];
+
+        int worklist_count = 0;
+        FOREACH_PRED(p, an, h) {
+            // Only a retreating edge can be a back edge.
+            int pi = an->rpo_index[(*p)->id];
+            if (pi >= i && dominates(an, h, *p))
+                worklist[worklist_count++] = *p;
+        }
+
+        if (worklist_count == 0)
+            continue;
+
+        Loop* loop = &loops[loop_count++];
+        loop->header = h;
+        m.loop_of_header[h->id] = loop;
+        m.loop_of_block[h->id] = loop;
+
+        while (worklist_count > 0)
+        {
+            IRBasicBlock* n = worklist[--worklist_count];
+
+            Loop* inner = m.loop_of_block[n->id];
+            if (!inner) {
+                m.loop_of_block[n->id] = loop;
+            }
+            else {
+                while (inner->parent)
+                    inner = inner->parent;
+                if (inner == loop)
+                    continue;
+                inner->parent = loop;
+                n = inner->header;
+            }
+
+            FOREACH_PRED(p, an, n) {
+                if (an->rpo_index[(*p)->id] != -1)
+                    worklist[worklist_count++] = *p;
+            }
+        }
+    }
+
+    if (loop_count == 0) {
+        release_scratch(&scratch);
+        return;
+    }
+
+    // Block lists, filled in reverse postorder.
+    for (int i = 0; i < an->rpo_count; ++i) {
+        for (Loop* l = m.loop_of_block[an->rpo[i]->id]; l; l = l->parent)
+            l->block_count++;
+    }
+
+    for (int l = 0; l < loop_count; ++l) {
+        loops[l].blocks = arena_push_array(scratch.arena, IRBasicBlock*, (u32)loops[l].block_count);
+        loops[l].block_count = 0;
+    }
+
+    for (int i = 0; i < an->rpo_count; ++i) {
+        IRBasicBlock* b = an->rpo[i];
+        for (Loop* l = m.loop_of_block[b->id]; l; l = l->parent)
+            l->blocks[l->block_count++] = b;
+    }
+
+    IRInstr** defs = find_defs(scratch.arena, ir);
+    IRInstr** invariant = arena_push_array(scratch.arena, IRInstr*, (u32)ir_instr_count(ir));
+    Bitset* is_invariant = bitset_alloc(scratch.arena, ir->next_reg);
+
+    for (int l = 0; l < loop_count; ++l)
+    {
+        Loop* loop = &loops[l];
+
+        int invariant_count = 0;
+        for (int i = 0; i < loop->block_count; ++i)
+        {
+            IRBasicBlock* b = loop->blocks[i];
+
+            // Preheaders of nested loops hold what was hoisted out of them.
+            Loop* inner = m.loop_of_header[b->id];
+            if (inner && inner != loop && inner->preheader)
+                find_invariants(&m, loop, defs, is_invariant, inner->preheader, invariant, &invariant_count);
+
+            find_invariants(&m, loop, defs, is_invariant, b, invariant, &invariant_count);
+        }
+
+        if (invariant_count == 0)
+            continue;
+
+        IRBasicBlock* pre = create_preheader(arena, &m, loop);
+
+        for (int i = 0; i < invariant_count; ++i)
+        {
+            IRInstr* instr = invariant[i];
+            bitset_unset(is_invariant, *ir_instr_dest(instr));
+
+            if (pre) {
+                remove_ir_instr(instr);
+                append_ir_instr(pre, instr);
+            }
+        }
+    }
+
+    if (m.next_block_id != nblock)
+        invalidate_ir_analysis(ir, ANALYSIS_CFG);
+
+    release_scratch(&scratch);
+}
+
+internal IRReg compact_reg(IRReg* map, IRReg* next, IRReg reg) {
+    if (map[reg] == IR_EMPTY_REG)
+        map[reg] = (*next)++;
+    return map[reg];
+}
+
+// Renumbers the registers that are still in use densely, in order of first
+// appearance. mem2reg and the passes after it leave gaps behind, and every
+// consumer sizes its tables (and the VM its frame) by next_reg.
+internal void compact_regs(Arena* arena, IR* ir) {
+    Scratch scratch = get_scratch(&arena, 1);
+
+    IRReg* map = arena_push_array(scratch.arena, IRReg, ir->next_reg);
+    memset(map, 0xff, ir->next_reg * sizeof(IRReg));
+
+    IRReg next = 1;
+
+    FOREACH_IR_BB(b, ir->first_block)
+    FOREACH_IR_INSTR(instr, b)
+    {
+        if (instr->op == IR_OP_PHI) {
+            for (int i = 0; i < instr->phi.param_count; ++i) {
+                IRPhiParam* param = &instr->phi.params[i];
+                if (param->reg != IR_EMPTY_REG)
+                    param->reg = compact_reg(map, &next, param->reg);
+            }
+        }
+        else {
+            IRValue* operands[2];
+            int operand_count = ir_instr_operands(instr, operands);
+            for (int i = 0; i < operand_count; ++i) {
+                if (operands[i]->kind == IR_VALUE_REG)
+                    operands[i]->reg = compact_reg(map, &next, operands[i]->reg);
+            }
+        }
+
+        IRReg* dest = ir_instr_dest(instr);
+        if (dest)
+            *dest = compact_reg(map, &next, *dest);
+    }
+
+    ir->next_reg = next;
+    invalidate_ir_analysis(ir, ANALYSIS_INSTRS);
+
+    release_scratch(&scratch);
+}
+
+typedef struct {
+    char* name;
+    void (*run)(Arena* arena, IR* ir);
+} OptPass;
+
+internal OptPass passes[] = {
+    { "mem2reg", mem2reg },
+    { "sccp",    sccp },
+    { "copyprop", copy_propagation },
+    { "gvn",     gvn },
+    { "copyprop", copy_propagation },
+    { "licm",    licm },
+    { "dce",     dead_code_elimination },
+    { "compact", compact_regs },
+};
+
+static_assert(LEN(passes) <= MAX_OPT_PASSES, "too many passes for OptTimings");
+
+void optimize(Arena* arena, IR* ir, OptTimings* timings) {
+    for (int i = 0; i < (int)LEN(passes); ++i)
+    {
+        double start = timings ? time_seconds() : 0.0;
+
+        passes[i].run(arena, ir);
+
+        if (timings) {
+            timings->names[i] = passes[i].name;
+            timings->seconds[i] = time_seconds() - start;
+            timings->count = i + 1;
+        }
+    }
+}
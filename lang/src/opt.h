@@ -2,4 +2,13 @@
 
 #include "ir.h"
 
-void optimize(Arena* arena, IR* ir);
+#define MAX_OPT_PASSES 16
+
+typedef struct {
+    int count;
+    char* names[MAX_OPT_PASSES];
+    double seconds[MAX_OPT_PASSES];
+} OptTimings;
+
+// Runs the pass pipeline. If timings is non-null, records how long each pass took.
+void optimize(Arena* arena, IR* ir, OptTimings* timings);
@@ -1,68 +1,111 @@
 #include "parse.h"
 #include "lex.h"
+#include "core.h"
 
 typedef struct {
-    Arena* arena;
-    char* src;
-    Lexer* l;
+    ASTPool* pool;
+    LexToken* tokens;
+    u32 token_count;
+    u32 pos;
+
+    // Statements of the blocks being parsed. A block pushes its statements and
+    // pops them into its node once it is complete.
+    ASTRef* stmt_stack;
+    u32 stmt_count;
 } P;
 
-AST* new_ast(Arena* arena, ASTKind kind, Token tok) {
+ASTRef new_ast(ASTPool* pool, ASTKind kind, u32 tok, size_t size) {
     assert(kind);
-    AST* ast = arena_push_type(arena, AST);
-    ast->kind = kind;
+    assert(size >= sizeof(AST));
+
+    AST* ast = arena_push_clear(pool->arena, size);
+    ast->kind = (u8)kind;
     ast->tok = tok;
-    return ast;
+
+    size_t offset = (u64*)ast - pool->base;
+    assert(offset <= UINT32_MAX);
+
+    pool->node_count++;
+    pool->node_bytes += arena_pad_size(size);
+
+    return (ASTRef)offset;
+}
+
+Token ast_token(ASTPool* pool, u32 tok) {
+    LexToken* t = &pool->tokens.tokens[tok];
+    return (Token) {
+        .kind = t->kind,
+        .len = (int)t->len,
+        .ptr = pool->src + t->offset,
+        .line = token_line(&pool->tokens, t->offset),
+        .atom = t->atom,
+    };
+}
+
+// Kind of the token `ahead` tokens past the current one.
+internal int peek_kind(P* p, u32 ahead) {
+    u32 i = p->pos + ahead;
+    return i < p->token_count ? p->tokens[i].kind : TOK_EOF;
+}
+
+// Returns the index of the current token and moves past it.
+internal u32 next(P* p) {
+    u32 tok = p->pos;
+    if (p->tokens[tok].kind != TOK_EOF)
+        ++p->pos;
+    return tok;
+}
+
+internal AST* node(P* p, ASTRef ref) {
+    return ast_node(p->pool, ref);
+}
+
+internal void error_at(P* p, u32 tok, char* desc) {
+    error_tok(p->pool->src, ast_token(p->pool, tok), desc);
 }
 
 internal bool match(P* p, int kind, char* desc) {
-    Token tok = lex_peek(p->l);
-    if (tok.kind == kind) {
-        lex(p->l);
+    if (peek_kind(p, 0) == kind) {
+        next(p);
         return true;
     }
 
-    error_tok(p->src, tok, "expected %s", desc);
+    error_tok(p->pool->src, ast_token(p->pool, p->pos), "expected %s", desc);
     return false;
 }
 
 #define REQUIRE(kind, desc) if (!match(p, kind, desc)) { return 0; }
 
-internal AST* parse_primary(P* p) {
-    Token tok = lex_peek(p->l);
-    switch (tok.kind)
+internal ASTRef parse_primary(P* p) {
+    switch (peek_kind(p, 0))
     {
         case TOK_INT: {
-            lex(p->l);
+            u32 tok = next(p);
+            LexToken* t = &p->tokens[tok];
+            char* digits = p->pool->src + t->offset;
 
             u64 val = 0;
-            for (int i = 0; i < tok.len; ++i) {
+            for (u32 i = 0; i < t->len; ++i) {
                 val *= 10;
-                val += tok.ptr[i] - '0';
+                val += digits[i] - '0';
             }
 
-            AST* expr = new_ast(p->arena, AST_INT, tok);
-            expr->int_val = val;
+            ASTRef expr = new_ast(p->pool, AST_INT, tok, sizeof(ASTInt));
+            ((ASTInt*)node(p, expr))->val = val;
 
             return expr;
         }
 
-        case TOK_IDENT: {
-            lex(p->l);
-
-            AST* expr = new_ast(p->arena, AST_VAR, tok);
-            expr->var.name = tok;
-
-            return expr;
-        }
+        case TOK_IDENT:
+            return new_ast(p->pool, AST_VAR, next(p), sizeof(ASTVar));
     }
 
-    error_tok(p->src, tok, "expected an expression");
+    error_at(p, p->pos, "expected an expression");
     return 0;
 }
 
-internal int bin_prec(Token op) {
-    switch (op.kind) {
+int bin_prec(int kind) {
+    switch (kind) {
         default:
             return 0;
 
@@ -83,221 +126,241 @@ internal int bin_prec(Token op) {
     }
 }
 
-internal AST* parse_bin(P* p, int caller_prec) {
-    AST* l = parse_primary(p);
+ASTKind bin_kind(int op_kind, bool* swap) {
+    *swap = false;
+
+    switch (op_kind) {
+        default:
+            assert(false);
+            return AST_ILLEGAL;
+        case '*':
+            return AST_MUL;
+        case '/':
+            return AST_DIV;
+        case '+':
+            return AST_ADD;
+        case '-':
+            return AST_SUB;
+        case '<':
+            return AST_LESS;
+        case '>':
+            *swap = true;
+            return AST_LESS;
+        case TOK_LEQUAL:
+            return AST_LEQUAL;
+        case TOK_GEQUAL:
+            *swap = true;
+            return AST_LEQUAL;
+        case TOK_EEQUAL:
+            return AST_EQUAL;
+        case TOK_NEQUAL:
+            return AST_NEQUAL;
+    }
+}
+
+internal ASTRef parse_bin(P* p, int caller_prec) {
+    ASTRef l = parse_primary(p);
     if (!l) return 0;
 
-    while (bin_prec(lex_peek(p->l)) > caller_prec) {
-        Token op = lex(p->l);
+    while (bin_prec(peek_kind(p, 0)) > caller_prec) {
+        u32 op = next(p);
+        int op_kind = p->tokens[op].kind;
 
-        AST* r = parse_bin(p, bin_prec(op));
+        ASTRef r = parse_bin(p, bin_prec(op_kind));
         if (!r) return 0;
 
-        bool swap = false;
+        bool swap;
+        ASTKind kind = bin_kind(op_kind, &swap);
 
-        ASTKind kind = AST_ILLEGAL;
-        switch (op.kind) {
-            case '*':
-                kind = AST_MUL;
-                break;
-            case '/':
-                kind = AST_DIV;
-                break;
-            case '+':
-                kind =  AST_ADD;
-                break;
-            case '-':
-                kind = AST_SUB;
-                break;
-            case '<':
-                kind = AST_LESS;
-                break;
-            case '>':
-                kind = AST_LESS;
-                swap = true;
-                break;
-            case TOK_LEQUAL:
-                kind = AST_LEQUAL;
-                break;
-            case TOK_GEQUAL:
-                kind = AST_LEQUAL;
-                swap = true;
-                break;
-            case TOK_EEQUAL:
-                kind = AST_EQUAL;
-                break;
-            case TOK_NEQUAL:
-                kind = AST_NEQUAL;
-                break;
-        }
+        ASTRef ref = new_ast(p->pool, kind, op, sizeof(ASTBin));
+        ASTBin* bin = (ASTBin*)node(p, ref);
+        bin->l = swap ? r : l;
+        bin->r = swap ? l : r;
 
-        AST* bin = new_ast(p->arena, kind, op);
-        bin->bin.l = swap ? r : l;
-        bin->bin.r = swap ? l : r;
-        
-        l = bin;
+        l = ref;
     }
 
     return l;
 }
 
-internal AST* parse_assign(P* p) {
-    AST* l= parse_bin(p, 0);
+internal ASTRef parse_assign(P* p) {
+    ASTRef l = parse_bin(p, 0);
     if (!l) return 0;
 
-    if (lex_peek(p->l).kind == '=') {
-        Token equals = lex(p->l);
+    if (peek_kind(p, 0) == '=') {
+        u32 equals = next(p);
 
-        AST* r = parse_assign(p);
+        ASTRef r = parse_assign(p);
         if (!r) return 0;
 
-        AST* bin = new_ast(p->arena, AST_ASSIGN, equals);
-        bin->bin.l = l;
-        bin->bin.r = r;
+        ASTRef ref = new_ast(p->pool, AST_ASSIGN, equals, sizeof(ASTBin));
+        ASTBin* bin = (ASTBin*)node(p, ref);
+        bin->l = l;
+        bin->r = r;
 
-        l = bin;
+        l = ref;
     }
 
     return l;
 }
 
-internal AST* parse_expr(P* p) {
+internal ASTRef parse_expr(P* p) {
     return parse_assign(p);
 }
 
-internal AST* parse_stmt(P* p, AST* parent_block);
+internal ASTRef parse_stmt(P* p);
 
-internal AST* parse_block(P* p) {
-    Token lbrace = lex_peek(p->l);
+internal ASTRef parse_block(P* p) {
+    u32 lbrace = p->pos;
     REQUIRE('{', "{");
 
-    AST head = { 0 };
-    AST* cur = &head;
-
-    AST* block = new_ast(p->arena, AST_BLOCK, lbrace);
+    u32 first = p->stmt_count;
 
-    while (lex_peek(p->l).kind != TOK_EOF &&
-           lex_peek(p->l).kind != '}')
+    while (peek_kind(p, 0) != TOK_EOF &&
+           peek_kind(p, 0) != '}')
     {
-        AST* stmt = parse_stmt(p, block);
+        ASTRef stmt = parse_stmt(p);
         if (!stmt) return 0;
-        cur = cur->next = stmt;
+        p->stmt_stack[p->stmt_count++] = stmt;
     }
 
     REQUIRE('}', "}");
 
-    block->block.first_stmt = head.next;
+    u32 count = p->stmt_count - first;
+    ASTRef ref = new_ast(p->pool, AST_BLOCK, lbrace, offsetof(ASTBlock, stmts) + count * sizeof(ASTRef));
+
+    ASTBlock* block = (ASTBlock*)node(p, ref);
+    block->count = count;
+    memcpy(block->stmts, p->stmt_stack + first, count * sizeof(ASTRef));
+
+    p->stmt_count = first;
 
-    return block;
+    return ref;
 }
 
-internal AST* parse_stmt(P* p, AST* parent_block) {
-    Token tok = lex_peek(p->l);
-    switch (tok.kind) {
+internal ASTRef parse_stmt(P* p) {
+    u32 tok = p->pos;
+    switch (peek_kind(p, 0)) {
         case '{':
             return parse_block(p);
 
         case TOK_RETURN: {
-            lex(p->l);
+            next(p);
 
-            AST* val = parse_expr(p);
+            ASTRef val = parse_expr(p);
             if (!val) return 0;
             REQUIRE(';', ";");
 
-            AST* ret = new_ast(p->arena, AST_RETURN, tok);
-            ret->return_val = val;
+            ASTRef ret = new_ast(p->pool, AST_RETURN, tok, sizeof(ASTReturn));
+            ((ASTReturn*)node(p, ret))->val = val;
 
             return ret;
         }
 
         case TOK_IDENT: {
-            lex(p->l);
-
-            if (lex_peek(p->l).kind != ':') {
-                lex_jump(p->l, tok);
+            if (peek_kind(p, 1) != ':')
                 break;
-            }
+
+            next(p);
 
             REQUIRE(':', ":");
 
-            Token type_name = lex_peek(p->l);
+            u32 type_name = p->pos;
             REQUIRE(TOK_IDENT, "a type");
 
-            Token assign_tok = lex_peek(p->l);
+            u32 assign_tok = p->pos;
             REQUIRE('=', "=");
 
-            AST* init = parse_expr(p);
+            ASTRef init = parse_expr(p);
             if (!init) return 0;
 
             REQUIRE(';', ";");
 
-            AST* node = new_ast(p->arena, AST_VAR_DECL, tok);
-            node->var_decl.name = tok;
-            node->var_decl.type_name = type_name;
-            node->var_decl.assign_tok= assign_tok;
-            node->var_decl.init = init;
+            ASTRef ref = new_ast(p->pool, AST_VAR_DECL, tok, sizeof(ASTVarDecl));
+            ASTVarDecl* decl = (ASTVarDecl*)node(p, ref);
+            decl->type_name = type_name;
+            decl->assign_tok = assign_tok;
+            decl->init = init;
 
-            parent_block->block.num_locals++;
-
-            return node;
+            return ref;
         }
 
         case TOK_IF: {
-            lex(p->l);
+            next(p);
 
-            AST* cond = parse_expr(p);
+            ASTRef cond = parse_expr(p);
             if (!cond) return 0;
 
-            AST* then = parse_block(p);
+            ASTRef then = parse_block(p);
             if (!then) return 0;
 
-            AST* els = 0;
-            if (lex_peek(p->l).kind == TOK_ELSE) {
-                lex(p->l);
+            ASTRef els = 0;
+            if (peek_kind(p, 0) == TOK_ELSE) {
+                next(p);
                 els = parse_block(p);
                 if (!els) return 0;
             }
 
-            AST* node = new_ast(p->arena, AST_IF, tok);
-            node->conditional.cond = cond;
-            node->conditional.then = then;
-            node->conditional.els = els;
+            ASTRef ref = new_ast(p->pool, AST_IF, tok, sizeof(ASTConditional));
+            ASTConditional* c = (ASTConditional*)node(p, ref);
+            c->cond = cond;
+            c->then = then;
+            c->els = els;
 
-            return node;
+            return ref;
         }
 
         case TOK_WHILE: {
-            lex(p->l);
+            next(p);
 
-            AST* cond = parse_expr(p);
+            ASTRef cond = parse_expr(p);
             if (!cond) return 0;
 
-            AST* then = parse_block(p);
+            ASTRef then = parse_block(p);
             if (!then) return 0;
 
-            AST* node = new_ast(p->arena, AST_WHILE, tok);
-            node->conditional.cond = cond;
-            node->conditional.then = then;
+            ASTRef ref = new_ast(p->pool, AST_WHILE, tok, sizeof(ASTConditional));
+            ASTConditional* c = (ASTConditional*)node(p, ref);
+            c->cond = cond;
+            c->then = then;
 
-            return node;
+            return ref;
         }
     }
 
-    AST* expr = parse_expr(p);
+    ASTRef expr = parse_expr(p);
     if (!expr) return 0;
     REQUIRE(';', ";");
 
     return expr;
 }
 
-AST* parse(Arena* arena, char* src) {
-    Lexer l = lex_init(src);
+ASTPool* ast_pool_create(Arena* arena, char* src) {
+    ASTPool* pool = arena_push_type(arena, ASTPool);
+    pool->arena = arena;
+    pool->src = src;
+    pool->tokens = tokenize(arena, src);
+
+    // The null node. Everything allocated after it has a positive ref.
+    pool->base = arena_push_type(arena, u64);
+
+    return pool;
+}
+
+ASTPool* parse(Arena* arena, char* src) {
+    ASTPool* pool = ast_pool_create(arena, src);
+
+    Scratch scratch = get_scratch(&arena, 1);
 
     P p = {
-        .arena = arena,
-        .src = src,
-        .l = &l
+        .pool = pool,
+        .tokens = pool->tokens.tokens,
+        .token_count = pool->tokens.count,
+        .stmt_stack = arena_push_array(scratch.arena, ASTRef, pool->tokens.count),
     };
 
-    return parse_block(&p);
+    pool->root = parse_block(&p);
+
+    release_scratch(&scratch);
+    return pool->root ? pool : 0;
 }
@@ -2,4 +2,13 @@
 
 #include "ast.h"
 
-AST* parse(Arena* arena, char* src);
+ASTPool* parse(Arena* arena, char* src);
+
+// Tokenizes `src` into a pool with no nodes yet. The fused front end uses the
+// pool for its tokens and error reporting only.
+ASTPool* ast_pool_create(Arena* arena, char* src);
+
+// Binding power of a binary operator token, 0 if it isn't one. bin_kind()
+// gives the node it parses to; `>` and `>=` swap their operands.
+int bin_prec(int kind);
+ASTKind bin_kind(int op_kind, bool* swap);
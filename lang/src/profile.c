@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "profile.h"
+#include "core.h"
+
+#define PROFILE_TOP_COUNT 10
+
+typedef struct {
+    u64 count;
+    int block;
+    int succ;
+    int len;
+} ProfileEntry;
+
+internal char* op_name(IROpCode op) {
+    static_assert(NUM_IR_OPS == 19, "not all ir ops handled");
+    switch (op) {
+        default:
+            assert(false);
+            return "?";
+        case IR_OP_PHI:
+            return "phi";
+        case IR_OP_COPY:
+            return "copy";
+        case IR_OP_STORE:
+            return "store";
+        case IR_OP_LOAD:
+            return "load";
+        case IR_OP_SEXT:
+            return "sext";
+        case IR_OP_ZEXT:
+            return "zext";
+        case IR_OP_TRUNC:
+            return "trunc";
+        case IR_OP_ADD:
+            return "add";
+        case IR_OP_SUB:
+            return "sub";
+        case IR_OP_MUL:
+            return "mul";
+        case IR_OP_DIV:
+            return "div";
+        case IR_OP_LESS:
+            return "cmp lt";
+        case IR_OP_LEQUAL:
+            return "cmp le";
+        case IR_OP_NEQUAL:
+            return "cmp ne";
+        case IR_OP_EQUAL:
+            return "cmp eq";
+        case IR_OP_RET:
+            return "ret";
+        case IR_OP_JMP:
+            return "jmp";
+        case IR_OP_BRANCH:
+            return "branch";
+    }
+}
+
+internal int compare_entry(const void* a, const void* b) {
+    u64 ca = ((ProfileEntry*)a)->count;
+    u64 cb = ((ProfileEntry*)b)->count;
+    return ca < cb ? 1 : ca > cb ? -1 : 0;
+}
+
+Profile collect_profile(IR* ir, Bytecode* bc) {
+    int nblock = ir_block_count(ir);
+    assert(bc->counter_count == nblock * 3);
+
+    Profile profile = {
+        .block_counts = bc->counters,
+        .edge_counts = bc->counters + nblock,
+    };
+
+    FOREACH_IR_BB(b, ir->first_block) {
+        u64 count = profile.block_counts[b->id];
+        FOREACH_IR_INSTR(instr, b)
+            profile.op_counts[instr->op] += count;
+        profile.retired += count * b->len;
+    }
+
+    return profile;
+}
+
+void print_profile(IR* ir, Profile* profile) {
+    Scratch scratch = get_scratch(0, 0);
+
+    int nblock = ir_block_count(ir);
+    ProfileEntry* blocks = arena_push_array(scratch.arena, ProfileEntry, nblock);
+    ProfileEntry* edges = arena_push_array(scratch.arena, ProfileEntry, nblock * 2);
+    int block_count = 0;
+    int edge_count = 0;
+
+    FOREACH_IR_BB(b, ir->first_block) {
+        blocks[block_count++] = (ProfileEntry) { .count = profile->block_counts[b->id], .block = b->id, .len = b->len };
+
+        BBList succ = bb_get_succ(b);
+        for (int i = 0; i < succ.count; ++i)
+            edges[edge_count++] = (ProfileEntry) { .count = profile->edge_counts[b->id * 2 + i], .block = b->id, .succ = succ.data[i]->id };
+    }
+
+    qsort(blocks, block_count, sizeof(ProfileEntry), compare_entry);
+    qsort(edges, edge_count, sizeof(ProfileEntry), compare_entry);
+
+    printf("Profile: %llu IR instructions retired\n", profile->retired);
+
+    // A block's share is the part of all retired instructions it ran.
+    printf("Hot blocks:\n");
+    for (int i = 0; i < block_count && i < PROFILE_TOP_COUNT && blocks[i].count > 0; ++i) {
+        double share = profile->retired ? 100.0 * (double)(blocks[i].count * blocks[i].len) / (double)profile->retired : 0.0;
+        printf("  bb.%-6d %14llu runs %6.2f%%\n", blocks[i].block, blocks[i].count, share);
+    }
+
+    printf("Hot edges:\n");
+    for (int i = 0; i < edge_count && i < PROFILE_TOP_COUNT && edges[i].count > 0; ++i)
+        printf("  bb.%d -> bb.%d: %llu\n", edges[i].block, edges[i].succ, edges[i].count);
+
+    printf("Retired per opcode:\n");
+    for (int op = 1; op < NUM_IR_OPS; ++op) {
+        if (profile->op_counts[op] > 0)
+            printf("  %-8s %14llu\n", op_name(op), profile->op_counts[op]);
+    }
+
+    release_scratch(&scratch);
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "ir.h"
+#include "vm.h"
+
+// Execution counts of a profiled run. Edges are indexed by block id * 2 +
+// successor index, in bb_get_succ order. IR instructions retired per opcode
+// follow from the block counts since a block runs all of its instructions.
+typedef struct {
+    u64* block_counts;
+    u64* edge_counts;
+    u64 op_counts[NUM_IR_OPS];
+    u64 retired;
+} Profile;
+
+// Reads the counters of bytecode lowered from `ir` with profiling on.
+Profile collect_profile(IR* ir, Bytecode* bc);
+
+// Prints the hottest blocks and edges and the instructions retired per opcode.
+void print_profile(IR* ir, Profile* profile);
@@ -0,0 +1,302 @@
+#include <stdlib.h>
+
+#include "regalloc.h"
+#include "analysis.h"
+#include "core.h"
+
+typedef struct {
+    IRReg reg;
+    u32 start;
+    u32 end;
+} LiveInterval;
+
+internal int compare_interval_start(const void* a, const void* b) {
+    const LiveInterval* x = a;
+    const LiveInterval* y = b;
+    if (x->start != y->start)
+        return x->start < y->start ? -1 : 1;
+    return x->reg < y->reg ? -1 : (x->reg > y->reg);
+}
+
+// Keeps `active` sorted by interval end so expiry only looks at the front
+// and the spill candidate is always at the back.
+internal void insert_active(LiveInterval* intervals, int* active, int* active_count, int index) {
+    int i = (*active_count)++;
+    while (i > 0 && intervals[active[i - 1]].end > intervals[index].end) {
+        active[i] = active[i - 1];
+        --i;
+    }
+    active[i] = index;
+}
+
+internal void remove_active_front(int* active, int* active_count) {
+    --(*active_count);
+    memmove(active, active + 1, *active_count * sizeof(active[0]));
+}
+
+internal bool loc_equal(RALoc a, RALoc b) {
+    return a.kind == b.kind && a.index == b.index;
+}
+
+RAMoveList sequentialize_moves(Arena* arena, RAMove* pending, int count) {
+    RAMoveList list = {
+        .moves = arena_push_array(arena, RAMove, count * 2),
+    };
+
+    for (int i = 0; i < count;) {
+        if (loc_equal(pending[i].dest, pending[i].src))
+            pending[i] = pending[--count];
+        else
+            ++i;
+    }
+
+    while (count > 0)
+    {
+        bool progress = false;
+
+        for (int i = 0; i < count; ++i)
+        {
+            bool blocked = false;
+            for (int j = 0; j < count; ++j) {
+                if (j != i && loc_equal(pending[j].src, pending[i].dest)) {
+                    blocked = true;
+                    break;
+                }
+            }
+
+            if (!blocked) {
+                list.moves[list.count++] = pending[i];
+                pending[i] = pending[--count];
+                progress = true;
+                break;
+            }
+        }
+
+        if (!progress) {
+            RALoc saved = pending[0].dest;
+            RALoc temp = { .kind = RA_LOC_TEMP };
+
+            list.moves[list.count++] = (RAMove) { .dest = temp, .src = saved };
+
+            for (int j = 0; j < count; ++j) {
+                if (loc_equal(pending[j].src, saved))
+                    pending[j].src = temp;
+            }
+        }
+    }
+
+    return list;
+}
+
+RegAlloc reg_alloc(Arena* arena, IR* ir, int num_regs) {
+    assert(num_regs >= 0 && num_regs <= 32);
+
+    Scratch scratch = get_scratch(&arena, 1);
+
+    int nblock = ir_block_count(ir);
+    u32 nreg = ir->next_reg;
+
+    IRAnalysis* an = get_ir_analysis(ir, ANALYSIS_LIVENESS);
+
+    u32* block_start = arena_push_array(scratch.arena, u32, nblock);
+    u32* block_end   = arena_push_array(scratch.arena, u32, nblock);
+
+    LiveInterval* by_reg = arena_push_array(scratch.arena, LiveInterval, nreg);
+    for (u32 r = 0; r < nreg; ++r) {
+        by_reg[r].reg = r;
+        by_reg[r].start = UINT32_MAX;
+    }
+
+    // Number instructions in layout order. Phis define their register at the
+    // start of the block; their operands are uses at the end of the predecessor.
+    u32 pos = 0;
+    FOREACH_IR_BB(b, ir->first_block)
+    {
+        block_start[b->id] = pos;
+
+        IRInstr* instr = b->start;
+        for (int i = 0; i < b->len; ++i)
+        {
+            IRValue* operands[2];
+            int operand_count = ir_instr_operands(instr, operands);
+
+            for (int k = 0; k < operand_count; ++k)
+            {
+                if (operands[k]->kind != IR_VALUE_REG)
+                    continue;
+
+                IRReg r = operands[k]->reg;
+                by_reg[r].end = pos > by_reg[r].end ? pos : by_reg[r].end;
+            }
+
+            IRReg* dest = ir_instr_dest(instr);
+            if (dest) {
+                u32 def = instr->op == IR_OP_PHI ? block_start[b->id] : pos;
+                by_reg[*dest].start = def < by_reg[*dest].start ? def : by_reg[*dest].start;
+                by_reg[*dest].end = def > by_reg[*dest].end ? def : by_reg[*dest].end;
+            }
+
+            pos += 2;
+            instr = instr->next;
+        }
+
+        block_end[b->id] = pos;
+        pos += 2;
+    }
+
+    // Intervals have no holes: each one spans from its first to its last
+    // live point in layout order.
+    u32 num_u32 = num_u32_for_bits(nreg);
+    FOREACH_IR_BB(b, ir->first_block)
+    {
+        for (u32 j = 0; j < num_u32; ++j)
+        {
+            u32 in = an->live_in[b->id]->p[j];
+            u32 out = an->live_out[b->id]->p[j];
+
+            for (u32 bit = 0; bit < 32; ++bit)
+            {
+                if (!(((in | out) >> bit) & 1))
+                    continue;
+
+                LiveInterval* it = &by_reg[j * 32 + bit];
+
+                if ((in >> bit) & 1) {
+                    it->start = block_start[b->id] < it->start ? block_start[b->id] : it->start;
+                    it->end = block_start[b->id] > it->end ? block_start[b->id] : it->end;
+                }
+
+                if ((out >> bit) & 1) {
+                    it->start = block_end[b->id] < it->start ? block_end[b->id] : it->start;
+                    it->end = block_end[b->id] > it->end ? block_end[b->id] : it->end;
+                }
+            }
+        }
+    }
+
+    int interval_count = 0;
+    LiveInterval* intervals = arena_push_array(scratch.arena, LiveInterval, nreg);
+    for (u32 r = 0; r < nreg; ++r) {
+        if (by_reg[r].start != UINT32_MAX)
+            intervals[interval_count++] = by_reg[r];
+    }
+
+    qsort(intervals, interval_count, sizeof(LiveInterval), compare_interval_start);
+
+    RegAlloc ra = {
+        .num_regs = num_regs,
+        .locs = arena_push_array(arena, RALoc, nreg),
+        .edge_moves = arena_push_array(arena, RAMoveList, nblock * 2),
+    };
+
+    // Assign registers, spilling whichever live interval ends last.
+    int* active = arena_push_array(scratch.arena, int, interval_count);
+    int active_count = 0;
+    u32 free_regs = num_regs == 32 ? UINT32_MAX : ((u32)1 << num_regs) - 1;
+
+    bool* spilled = arena_push_array(scratch.arena, bool, interval_count);
+
+    for (int i = 0; i < interval_count; ++i)
+    {
+        LiveInterval* cur = &intervals[i];
+
+        while (active_count > 0 && intervals[active[0]].end < cur->start) {
+            free_regs |= (u32)1 << ra.locs[intervals[active[0]].reg].index;
+            remove_active_front(active, &active_count);
+        }
+
+        if (free_regs) {
+            u32 index = 0;
+            while (!((free_regs >> index) & 1))
+                ++index;
+
+            free_regs &= ~((u32)1 << index);
+            ra.used_regs |= (u32)1 << index;
+            ra.locs[cur->reg] = (RALoc) { .kind = RA_LOC_REG, .index = index };
+            insert_active(intervals, active, &active_count, i);
+        }
+        else if (active_count > 0 && intervals[active[active_count - 1]].end > cur->end) {
+            int victim = active[--active_count];
+            ra.locs[cur->reg] = ra.locs[intervals[victim].reg];
+            spilled[victim] = true;
+            insert_active(intervals, active, &active_count, i);
+        }
+        else {
+            spilled[i] = true;
+        }
+    }
+
+    // Spilled intervals get frame slots, reusing slots whose previous owner
+    // has already died.
+    active_count = 0;
+    u32* free_slots = arena_push_array(scratch.arena, u32, interval_count);
+    int free_slot_count = 0;
+
+    for (int i = 0; i < interval_count; ++i)
+    {
+        if (!spilled[i])
+            continue;
+
+        LiveInterval* cur = &intervals[i];
+
+        while (active_count > 0 && intervals[active[0]].end < cur->start) {
+            free_slots[free_slot_count++] = ra.locs[intervals[active[0]].reg].index;
+            remove_active_front(active, &active_count);
+        }
+
+        u32 slot = free_slot_count > 0 ? free_slots[--free_slot_count] : ra.slot_count++;
+        ra.locs[cur->reg] = (RALoc) { .kind = RA_LOC_SLOT, .index = slot };
+        insert_active(intervals, active, &active_count, i);
+    }
+
+    // Resolve phis into moves on their incoming edges.
+    FOREACH_IR_BB(b, ir->first_block)
+    {
+        BBList succ = bb_get_succ(b);
+        for (int k = 0; k < succ.count; ++k)
+        {
+            IRBasicBlock* s = succ.data[k];
+
+            int phi_count = 0;
+            IRInstr* instr = s->start;
+            for (int i = 0; i < s->len && instr->op == IR_OP_PHI; ++i) {
+                ++phi_count;
+                instr = instr->next;
+            }
+
+            if (phi_count == 0)
+                continue;
+
+            RAMove* pending = arena_push_array(scratch.arena, RAMove, phi_count);
+            int pending_count = 0;
+
+            instr = s->start;
+            for (int i = 0; i < phi_count; ++i)
+            {
+                for (int p = 0; p < instr->phi.param_count; ++p)
+                {
+                    IRPhiParam* param = &instr->phi.params[p];
+                    if (param->block == b && param->reg != IR_EMPTY_REG) {
+                        pending[pending_count++] = (RAMove) {
+                            .dest = ra.locs[instr->phi.dest],
+                            .src = ra.locs[param->reg],
+                        };
+                        break;
+                    }
+                }
+
+                instr = instr->next;
+            }
+
+            ra.edge_moves[b->id * 2 + k] = sequentialize_moves(arena, pending, pending_count);
+        }
+    }
+
+    release_scratch(&scratch);
+    return ra;
+}
+
+RAMoveList* ra_edge_moves(RegAlloc* ra, IRBasicBlock* from, int succ_index) {
+    assert(succ_index >= 0 && succ_index < 2);
+    return &ra->edge_moves[from->id * 2 + succ_index];
+}
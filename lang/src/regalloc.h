@@ -0,0 +1,47 @@
+#pragma once
+
+#include "ir.h"
+
+typedef enum {
+    RA_LOC_NONE,
+    RA_LOC_REG,
+    RA_LOC_SLOT,
+    RA_LOC_TEMP,
+} RALocKind;
+
+typedef struct {
+    RALocKind kind;
+    u32 index;
+} RALoc;
+
+typedef struct {
+    RALoc dest;
+    RALoc src;
+} RAMove;
+
+typedef struct {
+    int count;
+    RAMove* moves;
+} RAMoveList;
+
+// Result of register allocation. Every IR register is mapped to one of
+// num_regs physical registers or to a spill slot for its whole lifetime.
+// Phis are resolved into sequential moves on each incoming edge, indexed by
+// predecessor id * 2 + the successor's index in bb_get_succ(). A move may
+// go through RA_LOC_TEMP to break a cycle; the backend supplies a register
+// for it.
+typedef struct {
+    int num_regs;
+    RALoc* locs;
+    u32 slot_count;
+    u32 used_regs;
+    RAMoveList* edge_moves;
+} RegAlloc;
+
+RegAlloc reg_alloc(Arena* arena, IR* ir, int num_regs);
+
+// Turns a parallel copy into a sequence of moves, breaking cycles through
+// RA_LOC_TEMP. Reorders `pending`.
+RAMoveList sequentialize_moves(Arena* arena, RAMove* pending, int count);
+
+RAMoveList* ra_edge_moves(RegAlloc* ra, IRBasicBlock* from, int succ_index);
@@ -1,37 +1,31 @@
 #include "sem.h"
 #include "core.h"
 
-Type ty_u8  = { .name = {.ptr = "u8",  .len = 2}, .size = 1, .flags = TYPE_IS_FIRST_CLASS };
-Type ty_u16 = { .name = {.ptr = "u16", .len = 3}, .size = 2, .flags = TYPE_IS_FIRST_CLASS }; 
-Type ty_u32 = { .name = {.ptr = "u32", .len = 3}, .size = 4, .flags = TYPE_IS_FIRST_CLASS };
-Type ty_u64 = { .name = {.ptr = "u64", .len = 3}, .size = 8, .flags = TYPE_IS_FIRST_CLASS };
+Type ty_u8  = { .name = {.ptr = "u8",  .len = 2}, .atom = ATOM_U8,  .size = 1, .flags = TYPE_IS_FIRST_CLASS };
+Type ty_u16 = { .name = {.ptr = "u16", .len = 3}, .atom = ATOM_U16, .size = 2, .flags = TYPE_IS_FIRST_CLASS }; 
+Type ty_u32 = { .name = {.ptr = "u32", .len = 3}, .atom = ATOM_U32, .size = 4, .flags = TYPE_IS_FIRST_CLASS };
+Type ty_u64 = { .name = {.ptr = "u64", .len = 3}, .atom = ATOM_U64, .size = 8, .flags = TYPE_IS_FIRST_CLASS };
 
-Type ty_i8  = { .name = {.ptr = "i8",  .len = 2}, .size = 1, .flags = TYPE_IS_FIRST_CLASS | TYPE_IS_SIGNED };
-Type ty_i16 = { .name = {.ptr = "i16", .len = 3}, .size = 2, .flags = TYPE_IS_FIRST_CLASS | TYPE_IS_SIGNED }; 
-Type ty_i32 = { .name = {.ptr = "i32", .len = 3}, .size = 4, .flags = TYPE_IS_FIRST_CLASS | TYPE_IS_SIGNED };
-Type ty_i64 = { .name = {.ptr = "i64", .len = 3}, .size = 8, .flags = TYPE_IS_FIRST_CLASS | TYPE_IS_SIGNED };
+Type ty_i8  = { .name = {.ptr = "i8",  .len = 2}, .atom = ATOM_I8,  .size = 1, .flags = TYPE_IS_FIRST_CLASS | TYPE_IS_SIGNED };
+Type ty_i16 = { .name = {.ptr = "i16", .len = 3}, .atom = ATOM_I16, .size = 2, .flags = TYPE_IS_FIRST_CLASS | TYPE_IS_SIGNED }; 
+Type ty_i32 = { .name = {.ptr = "i32", .len = 3}, .atom = ATOM_I32, .size = 4, .flags = TYPE_IS_FIRST_CLASS | TYPE_IS_SIGNED };
+Type ty_i64 = { .name = {.ptr = "i64", .len = 3}, .atom = ATOM_I64, .size = 8, .flags = TYPE_IS_FIRST_CLASS | TYPE_IS_SIGNED };
 
 Type ty_void = { .name = {.ptr = "void", .len = 4}, .size = 0, .flags = TYPE_IS_FIRST_CLASS };
 
-typedef struct {
+// bindings[atom] is the symbol the name currently refers to. Declarations bind
+// their name and the enclosing block clears the binding when it ends.
+struct Sem {
+    ASTPool* pool;
     Arena* arena;
-    char* src;
     Program* prog;
-} A;
-
-typedef struct Scope Scope;
-struct Scope {
-    Scope* parent;
-    u32 local_table_size;
-    Symbol** local_table;
+    Symbol** bindings;
 };
 
-internal bool token_match_string(Token tok, String str) {
-    return tok.len == str.len && memcmp(tok.ptr, str.ptr, tok.len) == 0;
-}
+typedef struct Sem A;
 
 internal void insert_type(Program* program, Type* type) {
-    u32 index = fnv_1_a_hash(type->name.ptr, type->name.len) % program->type_table_size;
+    u32 index = type->atom % program->type_table_size;
 
     for (int i = 0; i < program->type_table_size; ++i)
     {
@@ -65,36 +59,21 @@ Program program_init(Arena* arena) {
 
     return prog;
 }
-internal Symbol* find_symbol(Scope* scope, Token name) {
-    if (scope->local_table_size > 0) {
-        u32 index = fnv_1_a_hash(name.ptr, name.len) % scope->local_table_size;
-
-        for (u32 i = 0; i < scope->local_table_size; ++i)
-        {
-            if (!scope->local_table[index]) {
-                break;
-            }
-            else if (token_match_string(name, scope->local_table[index]->name)) {
-                return scope->local_table[index];
-            }
-
-            index = (index + 1) % scope->local_table_size;
-        }
-    }
-
-    if (scope->parent)
-        return find_symbol(scope->parent, name); 
+internal Symbol* find_symbol(A* a, Atom name) {
+    return a->bindings[name];
+}
 
-    return 0;
+internal void bind_symbol(A* a, Atom name, Symbol* sym) {
+    a->bindings[name] = sym;
 }
 
-internal Type* find_type(Program* prog, Token type_name) {
-    u32 index = fnv_1_a_hash(type_name.ptr, type_name.len) % prog->type_table_size;
+internal Type* find_type(Program* prog, Atom type_name) {
+    u32 index = type_name % prog->type_table_size;
 
     for (int i = 0; i < prog->type_table_size; ++i) {
         if (!prog->type_table[index])
             break;
-        else if (token_match_string(type_name, prog->type_table[index]->name))
+        else if (prog->type_table[index]->atom == type_name)
             return prog->type_table[index];
 
         index = (index + 1) % prog->type_table_size;
@@ -107,35 +86,124 @@ internal u64 get_primitive_priority(Type* type) {
     return type->size * 2 + ((type->flags & TYPE_IS_SIGNED) == 0);
 }
 
-internal AST* cast(Arena* arena, AST* expr, Type* type) {
-    AST* c = new_ast(arena, AST_CAST, expr->tok);
-    c->type = type;
-    c->cast.expr = expr;
-    return c;
+internal AST* node(A* a, ASTRef ref) {
+    return ast_node(a->pool, ref);
 }
 
-internal bool check_assign_types(A* a, Token tok, Type* left_type, AST** right) {
-    bool success = true;
+internal Atom token_atom(A* a, u32 tok) {
+    return a->pool->tokens.tokens[tok].atom;
+}
+
+internal void error_at(A* a, u32 tok, char* msg) {
+    error_tok(a->pool->src, ast_token(a->pool, tok), msg);
+}
+
+internal ASTRef cast(A* a, ASTRef expr, Type* type) {
+    ASTRef ref = new_ast(a->pool, AST_CAST, node(a, expr)->tok, sizeof(ASTCast));
+    ASTCast* c = (ASTCast*)node(a, ref);
+    c->base.type = type;
+    c->expr = expr;
+    return ref;
+}
+
+Symbol* sem_lookup(Sem* a, u32 tok) {
+    Symbol* sym = find_symbol(a, token_atom(a, tok));
+    if (!sym)
+        error_at(a, tok, "symbol does not exist");
+    return sym;
+}
 
-    if ((*right)->kind == AST_INT) {
-        (*right)->type = left_type;
+bool sem_declare(Sem* a, u32 name_tok, u32 type_tok, Symbol** out) {
+    *out = 0;
+
+    if (find_symbol(a, token_atom(a, name_tok))) {
+        error_at(a, name_tok, "symbol redefinition");
+        return false;
     }
-    else if ((*right)->type != left_type) {
-        if (get_primitive_priority((*right)->type) <
-            get_primitive_priority(left_type))
-        {
-            *right = cast(a->arena, *right, left_type);
-        }
-        else {
-            error_tok(a->src, tok, "lvalue cannot store this value because of its type");
-            success = false;
-        }
+
+    bool success = true;
+
+    Symbol* sym = arena_push_type(a->arena, Symbol);
+    sym->name = token_atom(a, name_tok);
+
+    Type* type = find_type(a->prog, token_atom(a, type_tok));
+    if (!type) {
+        error_at(a, type_tok, "not a valid type");
+        success = false;
+        type = &ty_void;
     }
 
+    sym->type = type;
+
+    bind_symbol(a, sym->name, sym);
+
+    *out = sym;
     return success;
 }
 
-internal bool sem(A* a, Scope* scope, AST* ast) {
+void sem_unbind(Sem* a, Symbol* sym) {
+    bind_symbol(a, sym->name, 0);
+}
+
+Type* sem_binary_type(Type* l, Type* r) {
+    u64 left_priority  = get_primitive_priority(l);
+    u64 right_priority = get_primitive_priority(r);
+    assert(l == r || left_priority != right_priority);
+    return left_priority >= right_priority ? l : r;
+}
+
+bool sem_check_assign(Sem* a, u32 tok, Type* to, Type* from) {
+    if (from != to && get_primitive_priority(from) >= get_primitive_priority(to)) {
+        error_at(a, tok, "lvalue cannot store this value because of its type");
+        return false;
+    }
+    return true;
+}
+
+u64 sem_fold(ASTKind kind, u64 l, u64 r) {
+    switch (kind) {
+        default:
+            assert(false);
+            return 0;
+        case AST_ADD:
+            return l + r;
+        case AST_SUB:
+            return l - r;
+        case AST_MUL:
+            return l * r;
+        case AST_DIV:
+            return l / r;
+        case AST_LESS:
+            return l < r;
+        case AST_LEQUAL:
+            return l <= r;
+        case AST_NEQUAL:
+            return l != r;
+        case AST_EQUAL:
+            return l == r;
+    }
+}
+
+internal bool check_assign_types(A* a, u32 tok, Type* left_type, ASTRef* right) {
+    AST* r = node(a, *right);
+
+    if (r->kind == AST_INT) {
+        r->type = left_type;
+        return true;
+    }
+
+    if (!sem_check_assign(a, tok, left_type, r->type))
+        return false;
+
+    if (r->type != left_type)
+        *right = cast(a, *right, left_type);
+
+    return true;
+}
+
+internal bool sem(A* a, ASTRef ref) {
+    AST* ast = node(a, ref);
+
     static_assert(NUM_AST_KINDS == 18, "not all ast kinds handled");
     switch (ast->kind) {
         default:
@@ -147,12 +215,10 @@ internal bool sem(A* a, Scope* scope, AST* ast) {
             return true;
 
         case AST_VAR: {
-            Symbol* sym = find_symbol(scope, ast->var.name);
-            if (!sym) {
-                error_tok(a->src, ast->var.name, "symbol does not exist");
+            Symbol* sym = sem_lookup(a, ast->tok);
+            if (!sym)
                 return false;
-            }
-            ast->var.sym = sym;
+            ((ASTVar*)ast)->sym = sym;
             ast->type = sym->type;
             return true;
         }
@@ -171,49 +237,22 @@ internal bool sem(A* a, Scope* scope, AST* ast) {
         {
             bool success = true;
 
-            AST* left = ast->bin.l;
-            AST* right = ast->bin.r;
+            ASTBin* bin = (ASTBin*)ast;
+            AST* left = node(a, bin->l);
+            AST* right = node(a, bin->r);
 
-            success &= sem(a, scope, left);
-            success &= sem(a, scope, right);
+            success &= sem(a, bin->l);
+            success &= sem(a, bin->r);
 
             if (left->kind == AST_INT &&
                 right->kind == AST_INT)
             {
-                u64 result = 0;
-
-                switch (ast->kind) {
-                    default:
-                        assert(false);
-                        break;
-                    case AST_ADD:
-                        result = left->int_val + right->int_val;
-                        break;
-                    case AST_SUB:
-                        result = left->int_val - right->int_val;
-                        break;
-                    case AST_MUL:
-                        result = left->int_val * right->int_val;
-                        break;
-                    case AST_DIV:
-                        result = left->int_val / right->int_val;
-                        break;
-                    case AST_LESS:
-                        result = left->int_val < right->int_val;
-                        break;
-                    case AST_LEQUAL:
-                        result = left->int_val <= right->int_val;
-                        break;
-                    case AST_NEQUAL:
-                        result = left->int_val != right->int_val;
-                        break;
-                    case AST_EQUAL:
-                        result = left->int_val == right->int_val;
-                        break;
-                }
+                u64 result = sem_fold(ast->kind, ((ASTInt*)left)->val, ((ASTInt*)right)->val);
 
+                // Folded in place, an integer node fits in a binary one.
+                static_assert(sizeof(ASTInt) <= sizeof(ASTBin), "folding needs the int node to fit");
                 ast->kind = AST_INT;
-                ast->int_val = result;
+                ((ASTInt*)ast)->val = result;
                 ast->type = &ty_u64;
             }
             else if (left->kind == AST_INT &&
@@ -230,17 +269,15 @@ internal bool sem(A* a, Scope* scope, AST* ast) {
             }
             else if (left->type != right->type)
             {
-                u64 left_priority  = get_primitive_priority(left->type);
-                u64 right_priority = get_primitive_priority(right->type);
-                assert(left_priority != right_priority);
+                ast->type = sem_binary_type(left->type, right->type);
 
-                if (left_priority > right_priority) {
-                    ast->bin.r = right = cast(a->arena, right, left->type);
-                    ast->type = left->type;
+                if (ast->type == left->type) {
+                    bin->r = cast(a, bin->r, left->type);
+                    right = node(a, bin->r);
                 }
                 else {
-                    ast->bin.l = left = cast(a->arena, left, right->type);
-                    ast->type = right->type;
+                    bin->l = cast(a, bin->l, right->type);
+                    left = node(a, bin->l);
                 }
             }
             else {
@@ -255,87 +292,56 @@ internal bool sem(A* a, Scope* scope, AST* ast) {
         case AST_ASSIGN: {
             bool success = true;
 
-            success &= sem(a, scope, ast->bin.l);
-            success &= sem(a, scope, ast->bin.r);
+            ASTBin* bin = (ASTBin*)ast;
+            AST* left = node(a, bin->l);
+
+            success &= sem(a, bin->l);
+            success &= sem(a, bin->r);
 
-            if (ast->bin.l->kind != AST_VAR) {
-                error_tok(a->src, ast->tok, "left operand is not assignable");
+            if (left->kind != AST_VAR) {
+                error_at(a, ast->tok, "left operand is not assignable");
                 success = false;
             }
 
-            success &= check_assign_types(a, ast->tok, ast->bin.l->type, &ast->bin.r);
-            ast->type = ast->bin.l->type;
+            success &= check_assign_types(a, ast->tok, left->type, &bin->r);
+            ast->type = left->type;
 
             return success;
         }
 
         case AST_BLOCK: {
-            Scratch scratch = get_scratch(&a->arena, 1);
-
             bool success = true;
 
-            u32 local_table_size = ast->block.num_locals * 2;
+            ASTBlock* block = (ASTBlock*)ast;
 
-            Scope inner_scope = {
-                .parent = scope,
-                .local_table_size = local_table_size,
-                .local_table = arena_push_array(scratch.arena, Symbol*, local_table_size)
-            };
+            for (u32 i = 0; i < block->count; ++i) {
+                success &= sem(a, block->stmts[i]);
+            }
 
-            for (AST* c = ast->block.first_stmt; c; c = c->next) {
-                success &= sem(a, &inner_scope, c);
+            // Redefinition is an error, so a declaration never shadows a visible
+            // symbol and leaving the block only has to clear its own names.
+            for (u32 i = 0; i < block->count; ++i) {
+                AST* c = node(a, block->stmts[i]);
+                if (c->kind == AST_VAR_DECL && ((ASTVarDecl*)c)->sym)
+                    sem_unbind(a, ((ASTVarDecl*)c)->sym);
             }
 
-            release_scratch(&scratch);
             return success;
         }
 
         case AST_RETURN: {
-            return sem(a, scope, ast->return_val);
+            return sem(a, ((ASTReturn*)ast)->val);
         } 
 
         case AST_VAR_DECL: {
-            bool success = true;
+            ASTVarDecl* decl = (ASTVarDecl*)ast;
 
-            if (find_symbol(scope, ast->var_decl.name)) {
-                error_tok(a->src, ast->var_decl.name, "symbol redefinition");
+            bool success = sem_declare(a, ast->tok, decl->type_name, &decl->sym);
+            if (!decl->sym)
                 return false;
-            }
-
-            Symbol* sym = arena_push_type(a->arena, Symbol);
-            sym->name = (String){
-                .len = ast->var_decl.name.len,
-                .ptr = arena_push(a->arena, ast->var_decl.name.len)
-            };
-            memcpy(sym->name.ptr, ast->var_decl.name.ptr, ast->var_decl.name.len);
-
-            Type* type = find_type(a->prog, ast->var_decl.type_name);
-            if (!type) {
-                error_tok(a->src, ast->var_decl.type_name, "not a valid type");
-                success = false;
-                type = &ty_void;
-            }
 
-            sym->type = type;
-
-            u32 table_index = fnv_1_a_hash(sym->name.ptr, sym->name.len) % scope->local_table_size;
-            bool inserted = false;
-
-            for (u32 i = 0; i < scope->local_table_size; ++i) {
-                if (!scope->local_table[table_index]) {
-                    scope->local_table[table_index] = sym;
-                    inserted = true;
-                    break;
-                }
-                table_index = (table_index + 1) % scope->local_table_size;
-            }
-
-            assert(inserted);
-
-            ast->var_decl.sym = sym;
-
-            success &= sem(a, scope, ast->var_decl.init);
-            success &= check_assign_types(a, ast->var_decl.assign_tok, type, &ast->var_decl.init);
+            success &= sem(a, decl->init);
+            success &= check_assign_types(a, decl->assign_tok, decl->sym->type, &decl->init);
 
             return success;
         }
@@ -345,11 +351,13 @@ internal bool sem(A* a, Scope* scope, AST* ast) {
         {
             bool success = true;
 
-            success &= sem(a, scope, ast->conditional.cond);
-            success &= sem(a, scope, ast->conditional.then);
+            ASTConditional* c = (ASTConditional*)ast;
 
-            if (ast->conditional.els) {
-                success &= sem(a, scope, ast->conditional.els);
+            success &= sem(a, c->cond);
+            success &= sem(a, c->then);
+
+            if (c->els) {
+                success &= sem(a, c->els);
             }
 
             return success;
@@ -357,12 +365,15 @@ internal bool sem(A* a, Scope* scope, AST* ast) {
     }
 }
 
-bool sem_ast(Arena* arena, char* src, Program* prog, AST* ast) {
-    A a = {
-        .arena = arena,
-        .src = src,
-        .prog = prog
-    };
+Sem* sem_begin(Arena* arena, Program* prog, ASTPool* pool) {
+    A* a = arena_push_type(arena, A);
+    a->pool = pool;
+    a->arena = arena;
+    a->prog = prog;
+    a->bindings = arena_push_array(arena, Symbol*, pool->tokens.atom_count);
+    return a;
+}
 
-    return sem(&a, 0, ast);
+bool sem_ast(Arena* arena, Program* prog, ASTPool* pool) {
+    return sem(sem_begin(arena, prog, pool), pool->root);
 }
@@ -4,4 +4,23 @@
 
 Program program_init(Arena* arena);
 
-bool sem_ast(Arena* arena, char* src, Program* prog, AST* ast);
+bool sem_ast(Arena* arena, Program* prog, ASTPool* pool);
+
+// Checker state shared by sem_ast() and the fused front end, which checks
+// while it parses. Symbols are allocated from `arena`, and a name stays bound
+// until sem_unbind() at the end of its block.
+typedef struct Sem Sem;
+
+Sem* sem_begin(Arena* arena, Program* prog, ASTPool* pool);
+
+// These report their own errors. sem_declare() leaves `sym` null on a
+// redefinition and gives it the void type if the type name is unknown.
+Symbol* sem_lookup(Sem* a, u32 tok);
+bool sem_declare(Sem* a, u32 name_tok, u32 type_tok, Symbol** sym);
+void sem_unbind(Sem* a, Symbol* sym);
+bool sem_check_assign(Sem* a, u32 tok, Type* to, Type* from);
+
+// Operands of different types meet at the one with the higher priority. Integer
+// literals take the type of the other operand, and two literals fold.
+Type* sem_binary_type(Type* l, Type* r);
+u64 sem_fold(ASTKind kind, u64 l, u64 r);
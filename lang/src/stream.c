@@ -0,0 +1,393 @@
+#include "stream.h"
+#include "core.h"
+#include "ir_gen.h"
+#include "parse.h"
+#include "sem.h"
+
+// A checked expression. Integer literals have no type, like AST_INT in sem(),
+// until an operand or a destination gives them one. A bare variable isn't
+// loaded until it is used, because it may turn out to be the target of an
+// assignment.
+typedef struct {
+    Type* type;
+    Symbol* var;
+    IRValue val;
+} Expr;
+
+typedef struct {
+    ASTPool* pool;
+    LexToken* tokens;
+    u32 token_count;
+    u32 pos;
+
+    Sem* sem;
+    IRGen* gen;
+
+    // Declarations of the blocks being parsed. A block unbinds its own when it
+    // is complete.
+    Symbol** scope;
+    u32 scope_count;
+
+    // Cleared by the first type error. Checking goes on to report the rest,
+    // but nothing more is generated.
+    bool success;
+} S;
+
+internal int peek_kind(S* s, u32 ahead) {
+    u32 i = s->pos + ahead;
+    return i < s->token_count ? s->tokens[i].kind : TOK_EOF;
+}
+
+internal u32 next(S* s) {
+    u32 tok = s->pos;
+    if (s->tokens[tok].kind != TOK_EOF)
+        ++s->pos;
+    return tok;
+}
+
+internal void error_at(S* s, u32 tok, char* desc) {
+    error_tok(s->pool->src, ast_token(s->pool, tok), desc);
+}
+
+internal bool match(S* s, int kind, char* desc) {
+    if (peek_kind(s, 0) == kind) {
+        next(s);
+        return true;
+    }
+
+    error_tok(s->pool->src, ast_token(s->pool, s->pos), "expected %s", desc);
+    return false;
+}
+
+#define REQUIRE(kind, desc) if (!match(s, kind, desc)) { return false; }
+
+// Literals that never meet a typed operand are u64, as in sem().
+internal Type* expr_type(Expr* e) {
+    return e->type ? e->type : &ty_u64;
+}
+
+internal void load(S* s, Expr* e) {
+    if (e->var && s->success)
+        e->val = ir_gen_load(s->gen, e->type, e->var->allocation);
+    e->var = 0;
+}
+
+// The value of a loaded expression as `type`, which it was checked against.
+internal IRValue convert(S* s, Expr* e, Type* type) {
+    if (!e->type || e->type == type)
+        return e->val;
+    return ir_gen_cast(s->gen, e->type, type, e->val);
+}
+
+internal bool parse_primary(S* s, Expr* e) {
+    *e = (Expr) { 0 };
+
+    switch (peek_kind(s, 0))
+    {
+        case TOK_INT: {
+            LexToken* t = &s->tokens[next(s)];
+            char* digits = s->pool->src + t->offset;
+
+            u64 val = 0;
+            for (u32 i = 0; i < t->len; ++i) {
+                val *= 10;
+                val += digits[i] - '0';
+            }
+
+            e->val = ir_integer_value(val);
+            return true;
+        }
+
+        case TOK_IDENT: {
+            Symbol* sym = sem_lookup(s->sem, next(s));
+            if (sym) {
+                e->type = sym->type;
+                e->var = sym;
+            }
+            else {
+                e->type = &ty_void;
+                s->success = false;
+            }
+            return true;
+        }
+    }
+
+    error_at(s, s->pos, "expected an expression");
+    return false;
+}
+
+internal bool parse_bin(S* s, int caller_prec, Expr* out) {
+    Expr l;
+    if (!parse_primary(s, &l)) return false;
+
+    while (bin_prec(peek_kind(s, 0)) > caller_prec) {
+        int op_kind = s->tokens[next(s)].kind;
+        load(s, &l);
+
+        Expr r;
+        if (!parse_bin(s, bin_prec(op_kind), &r)) return false;
+        load(s, &r);
+
+        bool swap;
+        ASTKind kind = bin_kind(op_kind, &swap);
+        if (swap) {
+            Expr tmp = l;
+            l = r;
+            r = tmp;
+        }
+
+        Expr result = { 0 };
+
+        if (!l.type && !r.type) {
+            result.val = ir_integer_value(sem_fold(kind, l.val.integer, r.val.integer));
+        }
+        else {
+            if (!l.type)
+                result.type = r.type;
+            else if (!r.type)
+                result.type = l.type;
+            else
+                result.type = sem_binary_type(l.type, r.type);
+
+            if (s->success) {
+                IRValue lv = convert(s, &l, result.type);
+                IRValue rv = convert(s, &r, result.type);
+                result.val = ir_gen_binary(s->gen, ir_gen_binary_op(kind), result.type, lv, rv);
+            }
+        }
+
+        l = result;
+    }
+
+    *out = l;
+    return true;
+}
+
+internal bool parse_assign(S* s, Expr* out) {
+    Expr l;
+    if (!parse_bin(s, 0, &l)) return false;
+
+    if (peek_kind(s, 0) == '=') {
+        u32 equals = next(s);
+
+        Expr r;
+        if (!parse_assign(s, &r)) return false;
+        load(s, &r);
+
+        // An undeclared name has already been reported.
+        if (!l.var && l.type != &ty_void) {
+            error_at(s, equals, "left operand is not assignable");
+            s->success = false;
+        }
+
+        Type* type = expr_type(&l);
+        if (!l.var)
+            s->success = false;
+        else if (r.type && !sem_check_assign(s->sem, equals, type, r.type))
+            s->success = false;
+
+        Expr result = { .type = type };
+        if (s->success) {
+            result.val = convert(s, &r, type);
+            ir_gen_store(s->gen, type, l.var->allocation, result.val);
+        }
+
+        l = result;
+    }
+
+    *out = l;
+    return true;
+}
+
+internal bool parse_expr(S* s, Expr* e) {
+    if (!parse_assign(s, e)) return false;
+    load(s, e);
+    return true;
+}
+
+internal bool parse_stmt(S* s);
+
+internal bool parse_block(S* s) {
+    REQUIRE('{', "{");
+
+    u32 first = s->scope_count;
+
+    while (peek_kind(s, 0) != TOK_EOF &&
+           peek_kind(s, 0) != '}')
+    {
+        if (!parse_stmt(s)) return false;
+    }
+
+    REQUIRE('}', "}");
+
+    // Redefinition is an error, so leaving the block only has to clear the
+    // names it declared.
+    for (u32 i = first; i < s->scope_count; ++i)
+        sem_unbind(s->sem, s->scope[i]);
+    s->scope_count = first;
+
+    return true;
+}
+
+internal bool parse_stmt(S* s) {
+    switch (peek_kind(s, 0)) {
+        case '{':
+            return parse_block(s);
+
+        case TOK_RETURN: {
+            next(s);
+
+            Expr val;
+            if (!parse_expr(s, &val)) return false;
+            REQUIRE(';', ";");
+
+            if (s->success)
+                ir_gen_return(s->gen, expr_type(&val), val.val);
+
+            return true;
+        }
+
+        case TOK_IDENT: {
+            if (peek_kind(s, 1) != ':')
+                break;
+
+            u32 name = next(s);
+
+            REQUIRE(':', ":");
+
+            u32 type_name = s->pos;
+            REQUIRE(TOK_IDENT, "a type");
+
+            u32 assign_tok = s->pos;
+            REQUIRE('=', "=");
+
+            // Bound before the initializer is parsed, as in sem().
+            Symbol* sym;
+            if (!sem_declare(s->sem, name, type_name, &sym))
+                s->success = false;
+
+            if (sym) {
+                s->scope[s->scope_count++] = sym;
+                if (s->success)
+                    sym->allocation = ir_gen_allocation(s->gen, sym->type);
+            }
+
+            Expr init;
+            if (!parse_expr(s, &init)) return false;
+            REQUIRE(';', ";");
+
+            if (!sym)
+                return true;
+
+            if (init.type && !sem_check_assign(s->sem, assign_tok, sym->type, init.type))
+                s->success = false;
+
+            if (s->success)
+                ir_gen_store(s->gen, sym->type, sym->allocation, convert(s, &init, sym->type));
+
+            return true;
+        }
+
+        case TOK_IF: {
+            next(s);
+
+            Expr cond;
+            if (!parse_expr(s, &cond)) return false;
+
+            IRBasicBlock* then = 0;
+            IRBasicBlock* els = 0;
+
+            if (s->success) {
+                then = ir_gen_new_block(s->gen);
+                els = ir_gen_new_block(s->gen);
+                ir_gen_branch(s->gen, expr_type(&cond), cond.val, then, els);
+                ir_gen_place_block(s->gen, then);
+            }
+
+            if (!parse_block(s)) return false;
+
+            if (peek_kind(s, 0) == TOK_ELSE) {
+                next(s);
+
+                IRBasicBlock* end = 0;
+                if (s->success) {
+                    end = ir_gen_new_block(s->gen);
+                    ir_gen_jump(s->gen, end);
+                    ir_gen_place_block(s->gen, els);
+                }
+
+                if (!parse_block(s)) return false;
+
+                if (s->success)
+                    ir_gen_place_block(s->gen, end);
+            }
+            else if (s->success) {
+                ir_gen_place_block(s->gen, els);
+            }
+
+            return true;
+        }
+
+        case TOK_WHILE: {
+            next(s);
+
+            IRBasicBlock* start = 0;
+            if (s->success) {
+                start = ir_gen_new_block(s->gen);
+                ir_gen_place_block(s->gen, start);
+            }
+
+            Expr cond;
+            if (!parse_expr(s, &cond)) return false;
+
+            IRBasicBlock* end = 0;
+            if (s->success) {
+                IRBasicBlock* body = ir_gen_new_block(s->gen);
+                end = ir_gen_new_block(s->gen);
+                ir_gen_branch(s->gen, expr_type(&cond), cond.val, body, end);
+                ir_gen_place_block(s->gen, body);
+            }
+
+            if (!parse_block(s)) return false;
+
+            if (s->success) {
+                ir_gen_jump(s->gen, start);
+                ir_gen_place_block(s->gen, end);
+            }
+
+            return true;
+        }
+    }
+
+    Expr expr;
+    if (!parse_expr(s, &expr)) return false;
+    REQUIRE(';', ";");
+
+    return true;
+}
+
+bool compile_stream(Arena* arena, char* src, Program* prog, IR* ir) {
+    ASTPool* pool = ast_pool_create(arena, src);
+
+    Scratch scratch = get_scratch(&arena, 1);
+
+    S s = {
+        .pool = pool,
+        .tokens = pool->tokens.tokens,
+        .token_count = pool->tokens.count,
+        .sem = sem_begin(arena, prog, pool),
+        .gen = ir_gen_begin(arena, pool),
+        .scope = arena_push_array(scratch.arena, Symbol*, pool->tokens.count),
+        .success = true,
+    };
+
+    bool parsed = parse_block(&s);
+
+    release_scratch(&scratch);
+
+    if (!parsed || !s.success)
+        return false;
+
+    *ir = ir_gen_end(s.gen);
+    return true;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "ast.h"
+#include "ir.h"
+
+// Fused front end: checks and generates IR from the parser's productions
+// without building a tree. Only the tokens, the symbol bindings and the stack
+// of declarations in open blocks are kept around. Returns false on a syntax or
+// type error, in which case `ir` is left untouched.
+bool compile_stream(Arena* arena, char* src, Program* prog, IR* ir);
@@ -0,0 +1,577 @@
+#include "vm.h"
+#include "core.h"
+#include "regalloc.h"
+
+#if defined(__GNUC__) || defined(__clang__)
+#define VM_THREADED 1
+#else
+#define VM_THREADED 0
+#endif
+
+// A CFG edge a branch cannot take directly, because it has phi moves or is
+// counted. It gets a stub after the code that does that and jumps to the block.
+typedef struct {
+    IRBasicBlock* from;
+    IRBasicBlock* to;
+    int succ_index;
+} VMEdgeStub;
+
+typedef struct {
+    Arena* arena;
+    Arena* scratch;
+    IR* ir;
+    u32 alloc_base;
+    u32 temp_slot;
+    u32 const_base;
+
+    u32* use_count;
+
+    // Profiled code counts each block at its start and each edge on its way
+    // out, into counters[block id] and counters[nblock + block id * 2 + succ].
+    bool profile;
+    int nblock;
+
+    int instr_count;
+    VMInstr* instrs;
+    int block_start;
+
+    int stub_count;
+    VMEdgeStub* stubs;
+
+    int const_count;
+    i64* consts;
+} L;
+
+internal VMInstr* emit_vm(L* l, VMOpCode op) {
+    VMInstr* instr = &l->instrs[l->instr_count++];
+    instr->op = op;
+    return instr;
+}
+
+internal u32 reg_slot(L* l, IRReg reg) {
+    assert(reg < l->ir->next_reg);
+    return reg;
+}
+
+internal u32 value_slot(L* l, IRValue value) {
+    switch (value.kind) {
+        default:
+            assert(false);
+            return 0;
+
+        case IR_VALUE_REG:
+            return reg_slot(l, value.reg);
+
+        case IR_VALUE_INTEGER: {
+            int index = l->const_count++;
+            l->consts[index] = (i64)value.integer;
+            return l->const_base + index;
+        }
+
+        case IR_VALUE_ALLOCATION:
+            return l->alloc_base + value.allocation->id;
+    }
+}
+
+internal bool starts_with_phi(IRBasicBlock* b) {
+    return b->len > 0 && b->start->op == IR_OP_PHI;
+}
+
+internal u32 move_slot(L* l, RALoc loc) {
+    assert(loc.kind == RA_LOC_SLOT || loc.kind == RA_LOC_TEMP);
+    return loc.kind == RA_LOC_TEMP ? l->temp_slot : loc.index;
+}
+
+// Emits the copies the phis at the start of `to` make when entered from `from`.
+// They happen in parallel, so they are ordered and cycles go through the temp slot.
+internal void emit_edge_moves(L* l, IRBasicBlock* from, IRBasicBlock* to) {
+    RAMove* pending = arena_push_array(l->scratch, RAMove, to->len);
+    int count = 0;
+
+    IRInstr* instr = to->start;
+    for (int i = 0; i < to->len && instr->op == IR_OP_PHI; ++i)
+    {
+        IRPhiParam* param = 0;
+        for (int j = 0; j < instr->phi.param_count; ++j) {
+            if (instr->phi.params[j].block == from) {
+                param = &instr->phi.params[j];
+                break;
+            }
+        }
+
+        assert(param);
+        if (param->reg != IR_EMPTY_REG) {
+            pending[count++] = (RAMove) {
+                .dest = { .kind = RA_LOC_SLOT, .index = reg_slot(l, instr->phi.dest) },
+                .src = { .kind = RA_LOC_SLOT, .index = reg_slot(l, param->reg) },
+            };
+        }
+
+        instr = instr->next;
+    }
+
+    RAMoveList moves = sequentialize_moves(l->scratch, pending, count);
+    for (int i = 0; i < moves.count; ++i) {
+        VMInstr* vi = emit_vm(l, VM_OP_COPY);
+        vi->dest = move_slot(l, moves.moves[i].dest);
+        vi->a = move_slot(l, moves.moves[i].src);
+    }
+}
+
+// A jump right after a copy of the same block or stub is fused with it, which
+// is how loop back edges end once their phi moves are emitted.
+internal void emit_jmp(L* l, u32 target) {
+    if (l->instr_count > l->block_start && l->instrs[l->instr_count - 1].op == VM_OP_COPY) {
+        VMInstr* last = &l->instrs[l->instr_count - 1];
+        last->op = VM_OP_COPY_JMP;
+        last->b = target;
+    }
+    else {
+        VMInstr* vi = emit_vm(l, VM_OP_JMP);
+        vi->a = target;
+    }
+}
+
+internal bool fits_imm(i64 val) {
+    return val >= INT32_MIN && val <= INT32_MAX;
+}
+
+// The variant of a typed op for `type`, given the op's first (I8) variant.
+internal VMOpCode typed_op(VMOpCode first, IRType type) {
+    static_assert(VM_OP_DIV_U64 - VM_OP_DIV_I8 == IR_TYPE_U64 - IR_TYPE_I8, "typed ops follow IRType order");
+    assert(type >= IR_TYPE_I8 && type <= IR_TYPE_U64);
+    return (VMOpCode)(first + (type - IR_TYPE_I8));
+}
+
+internal bool in_op_range(u32 op, VMOpCode first, VMOpCode last) {
+    return op >= (u32)first && op <= (u32)last;
+}
+
+// The fused compare-and-branch for a comparison, or VM_OP_ILLEGAL.
+internal VMOpCode branch_op(IROpCode op) {
+    switch (op) {
+        default:
+            return VM_OP_ILLEGAL;
+        case IR_OP_LESS:
+            return VM_OP_BRANCH_LESS_I8;
+        case IR_OP_LEQUAL:
+            return VM_OP_BRANCH_LEQUAL_I8;
+        case IR_OP_NEQUAL:
+            return VM_OP_BRANCH_NEQUAL_I8;
+        case IR_OP_EQUAL:
+            return VM_OP_BRANCH_EQUAL_I8;
+    }
+}
+
+internal void emit_edge_count(L* l, IRBasicBlock* from, int succ_index) {
+    if (l->profile) {
+        VMInstr* vi = emit_vm(l, VM_OP_COUNT);
+        vi->a = l->nblock + from->id * 2 + succ_index;
+    }
+}
+
+// Jump target for a branch edge. Block ids below the block count are blocks,
+// the ones above are edge stubs.
+internal u32 branch_target(L* l, IRBasicBlock* from, IRBasicBlock* to, int succ_index) {
+    if (!starts_with_phi(to) && !l->profile)
+        return to->id;
+
+    l->stubs[l->stub_count] = (VMEdgeStub) { .from = from, .to = to, .succ_index = succ_index };
+    return l->nblock + l->stub_count++;
+}
+
+Bytecode lower_ir(Arena* arena, IR* ir, bool profile) {
+    Scratch scratch = get_scratch(&arena, 1);
+
+    int nblock = ir_block_count(ir);
+    int nalloc = ir_allocation_count(ir);
+
+    u32* use_count = arena_push_array(scratch.arena, u32, ir->next_reg);
+
+    int ninstr = 0;
+    int nphi_param = 0;
+    FOREACH_IR_BB(b, ir->first_block) {
+        FOREACH_IR_INSTR(instr, b) {
+            ++ninstr;
+
+            IRValue* operands[2];
+            int operand_count = ir_instr_operands(instr, operands);
+            for (int i = 0; i < operand_count; ++i) {
+                if (operands[i]->kind == IR_VALUE_REG)
+                    ++use_count[operands[i]->reg];
+            }
+
+            if (instr->op == IR_OP_PHI) {
+                nphi_param += instr->phi.param_count;
+                for (int i = 0; i < instr->phi.param_count; ++i) {
+                    if (instr->phi.params[i].reg != IR_EMPTY_REG)
+                        ++use_count[instr->phi.params[i].reg];
+                }
+            }
+        }
+    }
+
+    // Edge moves take at most two copies per phi param, each branch may need
+    // two stub jumps, profiling counts a block and two edges per block, plus
+    // the final END.
+    int max_instrs = ninstr + nphi_param * 2 + nblock * 2 + (profile ? nblock * 3 : 0) + 1;
+
+    L l = {
+        .arena = arena,
+        .scratch = scratch.arena,
+        .ir = ir,
+        .use_count = use_count,
+        .profile = profile,
+        .nblock = nblock,
+        .alloc_base = ir->next_reg,
+        .temp_slot = ir->next_reg + nalloc,
+        .const_base = ir->next_reg + nalloc + 1,
+        .instrs = arena_push_array(scratch.arena, VMInstr, max_instrs),
+        .stubs = arena_push_array(scratch.arena, VMEdgeStub, nblock * 2),
+        .consts = arena_push_array(scratch.arena, i64, ninstr * 2),
+    };
+
+    u32* block_ip = arena_push_array(scratch.arena, u32, nblock * 3);
+
+    FOREACH_IR_BB(b, ir->first_block)
+    {
+        block_ip[b->id] = l.instr_count;
+        l.block_start = l.instr_count;
+
+        if (profile) {
+            VMInstr* vi = emit_vm(&l, VM_OP_COUNT);
+            vi->a = b->id;
+        }
+
+        IRInstr* instr = b->start;
+        for (int i = 0; i < b->len; ++i)
+        {
+            static_assert(NUM_IR_OPS == 19, "not all ir ops handled");
+            switch (instr->op) {
+                default:
+                    assert(false);
+                    break;
+
+                case IR_OP_PHI:
+                    // Done by the moves on the incoming edges.
+                    break;
+
+                case IR_OP_COPY: {
+                    VMInstr* vi = emit_vm(&l, VM_OP_COPY);
+                    vi->dest = reg_slot(&l, instr->copy.dest);
+                    vi->a = value_slot(&l, instr->copy.src);
+                } break;
+
+                case IR_OP_LOAD: {
+                    VMInstr* vi = emit_vm(&l, VM_OP_COPY);
+                    vi->dest = reg_slot(&l, instr->load.dest);
+                    vi->a = value_slot(&l, instr->load.loc);
+                } break;
+
+                case IR_OP_STORE: {
+                    VMInstr* vi = emit_vm(&l, VM_OP_COPY);
+                    vi->dest = value_slot(&l, instr->store.loc);
+                    vi->a = value_slot(&l, instr->store.src);
+                } break;
+
+                case IR_OP_SEXT:
+                case IR_OP_ZEXT: {
+                    assert((instr->op == IR_OP_SEXT) == ir_type_is_signed(instr->cast.type_src));
+
+                    VMInstr* vi = emit_vm(&l, typed_op(VM_OP_EXT_I8, instr->cast.type_src));
+                    vi->dest = reg_slot(&l, instr->cast.dest);
+                    vi->a = value_slot(&l, instr->cast.src);
+                } break;
+
+                // The low bits already are the narrower value.
+                case IR_OP_TRUNC: {
+                    VMInstr* vi = emit_vm(&l, VM_OP_COPY);
+                    vi->dest = reg_slot(&l, instr->cast.dest);
+                    vi->a = value_slot(&l, instr->cast.src);
+                } break;
+
+                case IR_OP_ADD:
+                case IR_OP_SUB:
+                case IR_OP_MUL:
+                case IR_OP_DIV:
+                case IR_OP_LESS:
+                case IR_OP_LEQUAL:
+                case IR_OP_NEQUAL:
+                case IR_OP_EQUAL:
+                {
+                    VMOpCode op = VM_OP_ILLEGAL;
+                    switch (instr->op) {
+                        case IR_OP_ADD:
+                            op = VM_OP_ADD;
+                            break;
+                        case IR_OP_SUB:
+                            op = VM_OP_SUB;
+                            break;
+                        case IR_OP_MUL:
+                            op = VM_OP_MUL;
+                            break;
+                        case IR_OP_DIV:
+                            op = typed_op(VM_OP_DIV_I8, instr->bin.type);
+                            break;
+                        case IR_OP_LESS:
+                            op = typed_op(VM_OP_LESS_I8, instr->bin.type);
+                            break;
+                        case IR_OP_LEQUAL:
+                            op = typed_op(VM_OP_LEQUAL_I8, instr->bin.type);
+                            break;
+                        case IR_OP_NEQUAL:
+                            op = typed_op(VM_OP_NEQUAL_I8, instr->bin.type);
+                            break;
+                        case IR_OP_EQUAL:
+                            op = typed_op(VM_OP_EQUAL_I8, instr->bin.type);
+                            break;
+                    }
+
+                    // A comparison only feeding the branch after it becomes one
+                    // compare-and-branch.
+                    IRInstr* end = b->end;
+                    if (branch_op(instr->op) != VM_OP_ILLEGAL &&
+                        instr->next == end && end->op == IR_OP_BRANCH &&
+                        end->branch.cond.kind == IR_VALUE_REG &&
+                        end->branch.cond.reg == instr->bin.dest &&
+                        l.use_count[instr->bin.dest] == 1)
+                    {
+                        VMInstr* vi = emit_vm(&l, typed_op(branch_op(instr->op), instr->bin.type));
+                        vi->a = value_slot(&l, instr->bin.l);
+                        vi->b = value_slot(&l, instr->bin.r);
+                        vi->c = branch_target(&l, b, end->branch.then_loc, 0);
+                        vi->d = branch_target(&l, b, end->branch.els_loc, 1);
+
+                        instr = end;
+                        ++i;
+                        break;
+                    }
+
+                    // Adding or subtracting a small constant keeps it in the instruction.
+                    IRValue* reg = &instr->bin.l;
+                    IRValue* imm = &instr->bin.r;
+                    if (instr->op == IR_OP_ADD && reg->kind == IR_VALUE_INTEGER) {
+                        reg = &instr->bin.r;
+                        imm = &instr->bin.l;
+                    }
+
+                    if ((instr->op == IR_OP_ADD || instr->op == IR_OP_SUB) &&
+                        reg->kind != IR_VALUE_INTEGER && imm->kind == IR_VALUE_INTEGER &&
+                        fits_imm((i64)imm->integer) && (i64)imm->integer != INT32_MIN)
+                    {
+                        i64 val = instr->op == IR_OP_ADD ? (i64)imm->integer : -(i64)imm->integer;
+
+                        VMInstr* vi = emit_vm(&l, VM_OP_ADD_IMM);
+                        vi->dest = reg_slot(&l, instr->bin.dest);
+                        vi->a = value_slot(&l, *reg);
+                        vi->b = (u32)(i32)val;
+                        break;
+                    }
+
+                    VMInstr* vi = emit_vm(&l, op);
+                    vi->dest = reg_slot(&l, instr->bin.dest);
+                    vi->a = value_slot(&l, instr->bin.l);
+                    vi->b = value_slot(&l, instr->bin.r);
+                } break;
+
+                case IR_OP_RET: {
+                    VMInstr* vi = emit_vm(&l, typed_op(VM_OP_RET_I8, instr->ret.type));
+                    vi->a = value_slot(&l, instr->ret.val);
+                } break;
+
+                case IR_OP_JMP: {
+                    emit_edge_count(&l, b, 0);
+                    if (starts_with_phi(instr->jmp_loc))
+                        emit_edge_moves(&l, b, instr->jmp_loc);
+
+                    emit_jmp(&l, instr->jmp_loc->id);
+                } break;
+
+                case IR_OP_BRANCH: {
+                    VMInstr* vi = emit_vm(&l, typed_op(VM_OP_BRANCH_I8, instr->branch.type));
+                    vi->a = value_slot(&l, instr->branch.cond);
+                    vi->b = branch_target(&l, b, instr->branch.then_loc, 0);
+                    vi->c = branch_target(&l, b, instr->branch.els_loc, 1);
+                } break;
+            }
+
+            instr = instr->next;
+        }
+
+        // Fall-through runs its edge moves at the end of the block.
+        if (!bb_is_terminated(b) && b->next) {
+            emit_edge_count(&l, b, 0);
+            if (starts_with_phi(b->next))
+                emit_edge_moves(&l, b, b->next);
+        }
+    }
+
+    emit_vm(&l, VM_OP_END);
+
+    for (int i = 0; i < l.stub_count; ++i) {
+        VMEdgeStub* stub = &l.stubs[i];
+        block_ip[nblock + i] = l.instr_count;
+        l.block_start = l.instr_count;
+
+        emit_edge_count(&l, stub->from, stub->succ_index);
+        emit_edge_moves(&l, stub->from, stub->to);
+        emit_jmp(&l, stub->to->id);
+    }
+
+    for (int i = 0; i < l.instr_count; ++i) {
+        VMInstr* vi = &l.instrs[i];
+        if (vi->op == VM_OP_JMP) {
+            vi->a = block_ip[vi->a];
+        }
+        else if (vi->op == VM_OP_COPY_JMP) {
+            vi->b = block_ip[vi->b];
+        }
+        else if (in_op_range(vi->op, VM_OP_BRANCH_I8, VM_OP_BRANCH_U64)) {
+            vi->b = block_ip[vi->b];
+            vi->c = block_ip[vi->c];
+        }
+        else if (in_op_range(vi->op, VM_OP_BRANCH_LESS_I8, VM_OP_BRANCH_EQUAL_U64)) {
+            vi->c = block_ip[vi->c];
+            vi->d = block_ip[vi->d];
+        }
+    }
+
+    Bytecode bc = {
+        .instr_count = l.instr_count,
+        .instrs = arena_push_array(arena, VMInstr, l.instr_count),
+        .frame_size = l.const_base + l.const_count,
+        .const_base = l.const_base,
+        .const_count = l.const_count,
+        .consts = arena_push_array(arena, i64, l.const_count),
+        .counter_count = profile ? nblock * 3 : 0,
+        .counters = profile ? arena_push_array(arena, u64, nblock * 3) : 0,
+    };
+
+    memcpy(bc.instrs, l.instrs, l.instr_count * sizeof(VMInstr));
+    memcpy(bc.consts, l.consts, l.const_count * sizeof(i64));
+
+    release_scratch(&scratch);
+    return bc;
+}
+
+#if VM_THREADED
+    #define VM_CASE(op) L_##op:
+    #define VM_NEXT() goto *ip->handler
+    #define VM_DISPATCH() goto *ip->handler;
+#else
+    #define VM_CASE(op) case op:
+    #define VM_NEXT() continue
+    #define VM_DISPATCH() for (;;) switch (ip->op)
+#endif
+
+// Bodies of the typed ops. Operands are read as `t` and results are stored
+// extended back to 64 bits. Signed division by -1 negates, so MIN / -1 wraps
+// to MIN instead of trapping.
+#define VM_SIGNED(t) ((t)-1 < (t)1)
+#define VM_BODY_EXT(t)           regs[ip->dest] = (i64)(t)regs[ip->a]; ++ip; VM_NEXT();
+#define VM_BODY_DIV(t)           regs[ip->dest] = (i64)(t)(VM_SIGNED(t) && (t)regs[ip->b] == (t)-1 ? (t)(0 - (u64)regs[ip->a]) : (t)regs[ip->a] / (t)regs[ip->b]); ++ip; VM_NEXT();
+#define VM_BODY_LESS(t)          regs[ip->dest] = (t)regs[ip->a] < (t)regs[ip->b]; ++ip; VM_NEXT();
+#define VM_BODY_LEQUAL(t)        regs[ip->dest] = (t)regs[ip->a] <= (t)regs[ip->b]; ++ip; VM_NEXT();
+#define VM_BODY_NEQUAL(t)        regs[ip->dest] = (t)regs[ip->a] != (t)regs[ip->b]; ++ip; VM_NEXT();
+#define VM_BODY_EQUAL(t)         regs[ip->dest] = (t)regs[ip->a] == (t)regs[ip->b]; ++ip; VM_NEXT();
+#define VM_BODY_RET(t)           *result = (i64)(t)regs[ip->a]; returned = true; goto done;
+#define VM_BODY_BRANCH(t)        ip = code + ((t)regs[ip->a] ? ip->b : ip->c); VM_NEXT();
+#define VM_BODY_BRANCH_LESS(t)   ip = code + ((t)regs[ip->a] < (t)regs[ip->b] ? ip->c : ip->d); VM_NEXT();
+#define VM_BODY_BRANCH_LEQUAL(t) ip = code + ((t)regs[ip->a] <= (t)regs[ip->b] ? ip->c : ip->d); VM_NEXT();
+#define VM_BODY_BRANCH_NEQUAL(t) ip = code + ((t)regs[ip->a] != (t)regs[ip->b] ? ip->c : ip->d); VM_NEXT();
+#define VM_BODY_BRANCH_EQUAL(t)  ip = code + ((t)regs[ip->a] == (t)regs[ip->b] ? ip->c : ip->d); VM_NEXT();
+
+#define VM_TYPED_CASE(op, T, t) VM_CASE(VM_OP_##op##_##T) { VM_BODY_##op(t) }
+#define VM_TYPED_CASES(op) VM_TYPES(VM_TYPED_CASE, op)
+
+#define VM_HANDLER(op, T, t) [VM_OP_##op##_##T] = &&L_VM_OP_##op##_##T,
+#define VM_HANDLERS(op) VM_TYPES(VM_HANDLER, op)
+
+bool vm_run(Bytecode* bc, i64* result) {
+#if VM_THREADED
+    static const void* handlers[NUM_VM_OPS] = {
+        [VM_OP_COPY]     = &&L_VM_OP_COPY,
+        [VM_OP_ADD]      = &&L_VM_OP_ADD,
+        [VM_OP_SUB]      = &&L_VM_OP_SUB,
+        [VM_OP_MUL]      = &&L_VM_OP_MUL,
+        [VM_OP_JMP]      = &&L_VM_OP_JMP,
+        [VM_OP_END]      = &&L_VM_OP_END,
+        [VM_OP_ADD_IMM]  = &&L_VM_OP_ADD_IMM,
+        [VM_OP_COPY_JMP] = &&L_VM_OP_COPY_JMP,
+        [VM_OP_COUNT]    = &&L_VM_OP_COUNT,
+
+        VM_TYPED_OPS(VM_HANDLERS)
+    };
+
+    if (!bc->threaded) {
+        for (int i = 0; i < bc->instr_count; ++i)
+            bc->instrs[i].handler = handlers[bc->instrs[i].op];
+        bc->threaded = true;
+    }
+#endif
+
+    Scratch scratch = get_scratch(0, 0);
+
+    i64* regs = arena_push_array(scratch.arena, i64, bc->frame_size);
+    memcpy(regs + bc->const_base, bc->consts, bc->const_count * sizeof(i64));
+
+    VMInstr* code = bc->instrs;
+    u64* counters = bc->counters;
+    VMInstr* ip = code;
+    bool returned = false;
+
+    static_assert(NUM_VM_OPS == 106, "not all vm ops handled");
+    VM_DISPATCH() {
+#if !VM_THREADED
+        default:
+            assert(false);
+            goto done;
+#endif
+
+        VM_CASE(VM_OP_COPY)
+            regs[ip->dest] = regs[ip->a];
+            ++ip;
+            VM_NEXT();
+
+        // Wrapping at 64 bits keeps the low bits right for every narrower type.
+        VM_CASE(VM_OP_ADD)
+            regs[ip->dest] = (i64)((u64)regs[ip->a] + (u64)regs[ip->b]);
+            ++ip;
+            VM_NEXT();
+        VM_CASE(VM_OP_SUB)
+            regs[ip->dest] = (i64)((u64)regs[ip->a] - (u64)regs[ip->b]);
+            ++ip;
+            VM_NEXT();
+        VM_CASE(VM_OP_MUL)
+            regs[ip->dest] = (i64)((u64)regs[ip->a] * (u64)regs[ip->b]);
+            ++ip;
+            VM_NEXT();
+        VM_CASE(VM_OP_ADD_IMM)
+            regs[ip->dest] = (i64)((u64)regs[ip->a] + (u64)(i64)(i32)ip->b);
+            ++ip;
+            VM_NEXT();
+
+        VM_CASE(VM_OP_COPY_JMP)
+            regs[ip->dest] = regs[ip->a];
+            ip = code + ip->b;
+            VM_NEXT();
+
+        VM_CASE(VM_OP_COUNT)
+            ++counters[ip->a];
+            ++ip;
+            VM_NEXT();
+
+        VM_CASE(VM_OP_JMP)
+            ip = code + ip->a;
+            VM_NEXT();
+
+        VM_TYPED_OPS(VM_TYPED_CASES)
+
+        VM_CASE(VM_OP_END)
+            goto done;
+    }
+
+done:
+    release_scratch(&scratch);
+    return returned;
+}
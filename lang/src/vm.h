@@ -0,0 +1,111 @@
+#pragma once
+
+#include "ir.h"
+
+// The integer types of typed ops, in IRType order.
+#define VM_TYPES(X, op) \
+    X(op, I8,  i8)      \
+    X(op, I16, i16)     \
+    X(op, I32, i32)     \
+    X(op, I64, i64)     \
+    X(op, U8,  u8)      \
+    X(op, U16, u16)     \
+    X(op, U32, u32)     \
+    X(op, U64, u64)
+
+// Ops that read their operands at a width and signedness, with one variant per
+// type, e.g. VM_OP_DIV_I8 .. VM_OP_DIV_U64.
+#define VM_TYPED_OPS(X) \
+    X(EXT)              \
+    X(DIV)              \
+    X(LESS)             \
+    X(LEQUAL)           \
+    X(NEQUAL)           \
+    X(EQUAL)            \
+    X(RET)              \
+    X(BRANCH)           \
+    X(BRANCH_LESS)      \
+    X(BRANCH_LEQUAL)    \
+    X(BRANCH_NEQUAL)    \
+    X(BRANCH_EQUAL)
+
+#define VM_OP_VARIANT(op, T, t) VM_OP_##op##_##T,
+#define VM_OP_VARIANTS(op) VM_TYPES(VM_OP_VARIANT, op)
+
+typedef enum {
+    VM_OP_ILLEGAL,
+
+    VM_OP_COPY,
+
+    VM_OP_ADD,
+    VM_OP_SUB,
+    VM_OP_MUL,
+
+    VM_OP_JMP,
+    VM_OP_END,
+
+    // Superinstructions, picked when lowering.
+    VM_OP_ADD_IMM,
+    VM_OP_COPY_JMP,
+
+    // Only in profiled code.
+    VM_OP_COUNT,
+
+    VM_TYPED_OPS(VM_OP_VARIANTS)
+
+    NUM_VM_OPS
+} VMOpCode;
+
+// Every operand is a slot index into the frame. The frame holds the IR
+// registers, then one slot per allocation, a temp slot, then the constant
+// pool, so handlers never have to check what kind of value they are reading.
+//
+// Slots hold 64 bits. Untyped ops compute on all of them, which leaves the low
+// bits right for any narrower type; typed ops read their operands as their
+// type, so what lies above the width never matters.
+//
+// Phis are resolved when lowering: each edge into a block with phis carries
+// their copies, emitted before the jump or in a stub the branch targets.
+//
+//   COPY:   dest = a
+//   binary: dest = a op b
+//   EXT:    dest = a, extended from its type
+//   RET:    return a
+//   JMP:    ip = a
+//   BRANCH: ip = a ? b : c
+//
+//   ADD_IMM:    dest = a + (i32)b
+//   COPY_JMP:   dest = a, ip = b
+//   BRANCH_cmp: ip = a cmp b ? c : d
+//
+//   COUNT:  ++counters[a]
+typedef struct {
+    const void* handler;
+    u32 op;
+    u32 dest;
+    u32 a;
+    u32 b;
+    u32 c;
+    u32 d;
+} VMInstr;
+
+typedef struct {
+    int instr_count;
+    VMInstr* instrs;
+
+    u32 frame_size;
+    u32 const_base;
+    int const_count;
+    i64* consts;
+
+    // Execution counts of profiled code, see lower_ir.
+    int counter_count;
+    u64* counters;
+
+    bool threaded;
+} Bytecode;
+
+// Profiled code counts every block and CFG edge it runs into `counters`: the
+// blocks by id, then the edges by block id * 2 + successor index.
+Bytecode lower_ir(Arena* arena, IR* ir, bool profile);
+bool vm_run(Bytecode* bc, i64* result);